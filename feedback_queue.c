@@ -12,46 +12,112 @@
         }                                        \
     }
 
+_Static_assert(sizeof(Thread) == CACHE_LINE, "hot TCB must fit one cache line");
+
+/* like strncpy but without zero-filling the rest of dst, and always terminated */
+static void copy_str(char *dst, const char *src)
+{
+    size_t len = strnlen(src, MAX_STR_LEN - 1);
+
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
 Queue *create_queue()
 {
     Queue *Q;
     FAIL_IF(!(Q = malloc(sizeof(Queue))), "Queue head malloc failure!");
     FAIL_IF(!(Q->q = malloc(sizeof(Thread *) * N_QUEUES)), "Queue array malloc failure!");
+    FAIL_IF(!(Q->tail = malloc(sizeof(Thread *) * N_QUEUES)), "Queue tail array malloc failure!");
+    FAIL_IF(posix_memalign((void **)&Q->threads, CACHE_LINE, sizeof(Thread) * MAX_THREAD_NUM),
+            "Thread table malloc failure!");
+    // calloc leaves never-used slots untouched, so their pages are never faulted in
+    FAIL_IF(!(Q->cold = calloc(MAX_THREAD_NUM, sizeof(ThreadCold))), "Thread cold table malloc failure!");
+    // an index stack rather than a list through next, so taking many slots
+    // in a row does not chase one cache miss after another
+    FAIL_IF(!(Q->free_slots = malloc(sizeof(int) * MAX_THREAD_NUM)), "Free slot stack malloc failure!");
 
     for (int i = 0; i < N_QUEUES; ++i)
+    {
         Q->q[i] = NULL;
+        Q->tail[i] = NULL;
+    }
+    Q->wait_queues = NULL;
+    Q->n_free = 0;
+    Q->n_slots = 0;
 
     return Q;
 }
 
-Thread *init_thread(int tid,
+void free_queue(Queue *Q)
+{
+    free(Q->q);
+    free(Q->tail);
+    free(Q->threads);
+    free(Q->cold);
+    free(Q->free_slots);
+    free(Q);
+}
+
+/* returns NULL once all MAX_THREAD_NUM slots are in use */
+Thread *init_thread(Queue *Q,
+                    int tid,
                     char *name,
                     char *p_func,
                     Prior b_priority,
                     int cancel_mode)
 {
     Thread *T;
+    int slot;
 
-    FAIL_IF(!(T = malloc(sizeof(Thread))), "Thread malloc failure!");
+    if (Q->n_free > 0)
+        T = &Q->threads[Q->free_slots[--Q->n_free]];
+    else if (Q->n_slots < MAX_THREAD_NUM)
+        T = &Q->threads[Q->n_slots++];
+    else
+        return NULL;
+
+    slot = T - Q->threads;
+    T->cold = &Q->cold[slot];
 
     T->tid = tid;
     T->state = READY;
-    strncpy(T->name, name, MAX_STR_LEN);
-    strncpy(T->p_func, p_func, MAX_STR_LEN);
+    copy_str(T->cold->name, name);
+    copy_str(T->cold->p_func, p_func);
     T->b_priority = b_priority; // base priority
     T->c_priority = b_priority; // current priority
-    T->cancel_mode = cancel_mode;
+    T->cold->cancel_mode = cancel_mode;
     T->am_cancelled = false;
     T->event_id = 0;
     T->queue_time = 0;
     T->wait_time = 0;
     T->elapsed = 0;
     T->timer = 0;
+    T->api_active = false;
+    T->idle_quanta = 0;
+    T->preempt_off = 0;
+    T->cold->blocked_on = NULL;
+    T->cold->wait_data = NULL;
+    T->cold->wait_cancel = NULL;
+    T->cold->owned = NULL;
+    T->cold->unboosted_priority = b_priority;
+    T->cold->script = NULL;
+    T->cold->cpu_time = 0;
+    memset(T->cold->tls, 0, sizeof(T->cold->tls));
+    T->cold->spawn = NULL;
+    T->cold->spawn_pending = false;
     T->next = NULL;
 
     return T;
 }
 
+void free_thread(Queue *Q, Thread *T)
+{
+    T->state = UNUSED;
+    T->next = NULL;
+    Q->free_slots[Q->n_free++] = T - Q->threads;
+}
+
 int get_queue_idx(State Q_type, Prior c_priority, int event_id)
 {
     if (Q_type == TERMINATED)
@@ -79,14 +145,24 @@ int get_queue_idx(State Q_type, Prior c_priority, int event_id)
 int fill_thread_id_list(Queue *Q, Thread *Running, Thread **list)
 {
     Thread *p;
-    int count = 1;
+    WaitQueue *w;
+    int count = 0;
 
-    memset(list, 0, MAX_THREAD_NUM);
+    // only list[0..count) is written; callers never read past it
+    if (Running)
+        list[count++] = Running;
+    for (int i = 0; i < N_QUEUES; ++i)
+    {
+        for (p = Q->q[i]; p != NULL && count < MAX_THREAD_NUM; p = p->next)
+        {
+            list[count++] = p;
+        }
+    }
 
-    list[0] = Running;
-    for (int i = 1; i < N_QUEUES; ++i)
+    /* threads blocked on mutexes, condition variables and semaphores */
+    for (w = Q->wait_queues; w != NULL; w = w->next)
     {
-        for (p = Q->q[i - 1]; p != NULL; p = p->next)
+        for (p = w->head; p != NULL && count < MAX_THREAD_NUM; p = p->next)
         {
             list[count++] = p;
         }
@@ -97,36 +173,55 @@ int fill_thread_id_list(Queue *Q, Thread *Running, Thread **list)
 
 int enqueue(Queue *Q, Thread *T, State Q_type, int event_id)
 {
-    Thread *p;
-
     int index = get_queue_idx(Q_type, T->c_priority, event_id);
 
-    for (p = Q->q[index]; p != NULL; p = p->next)
-    {
-        if (p->tid == T->tid)
-            return -1;
-        if (!p->next)
-            break;
-    } // p = last node in the linked list
+    // only the tail of a list has a NULL next, so T is already linked here
+    if (T->next || Q->tail[index] == T)
+        return -1;
 
-    if (!p)
+    if (!Q->tail[index])
         Q->q[index] = T;
     else
-        p->next = T;
+        Q->tail[index]->next = T;
+    Q->tail[index] = T;
 
     // printf("enqueue idx: %d\n", index);
     // printf("tid: %d\n", T->tid);
     // printf("state: %d\n", T->state);
-    // printf("name: %s\n", T->name);
-    // printf("entry function: %s\n", T->p_func);
+    // printf("name: %s\n", T->cold->name);
+    // printf("entry function: %s\n", T->cold->p_func);
     // printf("priority: %d\n", T->b_priority);
     // printf("priority: %d\n", T->c_priority);
-    // printf("cancel mode: %d\n", T->cancel_mode);
+    // printf("cancel mode: %d\n", T->cold->cancel_mode);
     // printf("Event id: %d\n", T->event_id);
     // printf("next: %p\n\n", T->next);
     return 0;
 }
 
+int enqueue_head(Queue *Q, Thread *T, State Q_type, int event_id)
+{
+    int index = get_queue_idx(Q_type, T->c_priority, event_id);
+
+    T->next = Q->q[index];
+    Q->q[index] = T;
+    if (!T->next)
+        Q->tail[index] = T;
+    return 0;
+}
+
+/* append an already linked first..last run, all with the same queue index */
+void enqueue_batch(Queue *Q, Thread *first, Thread *last, State Q_type, int event_id)
+{
+    int index = get_queue_idx(Q_type, first->c_priority, event_id);
+
+    last->next = NULL;
+    if (!Q->tail[index])
+        Q->q[index] = first;
+    else
+        Q->tail[index]->next = first;
+    Q->tail[index] = last;
+}
+
 Thread *dequeue(Queue *Q, State Q_type, Prior c_priority, int event_id)
 {
     Thread *p;
@@ -135,15 +230,17 @@ Thread *dequeue(Queue *Q, State Q_type, Prior c_priority, int event_id)
     if ((p = Q->q[index]))
     {
         Q->q[index] = p->next;
+        if (!p->next)
+            Q->tail[index] = NULL;
         p->next = NULL;
         // printf("dequeue idx: %d\n", index);
         // printf("tid: %d\n", p->tid);
         // printf("state: %d\n", p->state);
-        // printf("name: %s\n", p->name);
-        // printf("entry function: %s\n", p->p_func);
+        // printf("name: %s\n", p->cold->name);
+        // printf("entry function: %s\n", p->cold->p_func);
         // printf("priority: %d\n", p->b_priority);
         // printf("priority: %d\n", p->c_priority);
-        // printf("cancel mode: %d\n", p->cancel_mode);
+        // printf("cancel mode: %d\n", p->cold->cancel_mode);
         // printf("Event id: %d\n", p->event_id);
         // printf("next: %p\n\n", p->next);
         return p;
@@ -175,15 +272,17 @@ Thread *dequeue_wait_time(Queue *Q, int tid)
         if (p->tid == tid)
         {
             Q->q[index] = p->next;
+            if (!p->next)
+                Q->tail[index] = NULL;
             p->next = NULL;
             // printf("dequeue idx: %d\n", index);
             // printf("tid: %d\n", p->tid);
             // printf("state: %d\n", p->state);
-            // printf("name: %s\n", p->name);
-            // printf("entry function: %s\n", p->p_func);
+            // printf("name: %s\n", p->cold->name);
+            // printf("entry function: %s\n", p->cold->p_func);
             // printf("priority: %d\n", p->b_priority);
             // printf("priority: %d\n", p->c_priority);
-            // printf("cancel mode: %d\n", p->cancel_mode);
+            // printf("cancel mode: %d\n", p->cold->cancel_mode);
             // printf("Event id: %d\n", p->event_id);
             // printf("next: %p\n\n", p->next);
             return p;
@@ -200,15 +299,17 @@ Thread *dequeue_wait_time(Queue *Q, int tid)
         if (p->tid == tid)
         {
             prev->next = p->next;
+            if (!p->next)
+                Q->tail[index] = prev;
             p->next = NULL;
             // printf("dequeue idx: %d\n", index);
             // printf("tid: %d\n", p->tid);
             // printf("state: %d\n", p->state);
-            // printf("name: %s\n", p->name);
-            // printf("entry function: %s\n", p->p_func);
+            // printf("name: %s\n", p->cold->name);
+            // printf("entry function: %s\n", p->cold->p_func);
             // printf("priority: %d\n", p->b_priority);
             // printf("priority: %d\n", p->c_priority);
-            // printf("cancel mode: %d\n", p->cancel_mode);
+            // printf("cancel mode: %d\n", p->cold->cancel_mode);
             // printf("Event id: %d\n", p->event_id);
             // printf("next: %p\n\n", p->next);
             return p;
@@ -217,6 +318,108 @@ Thread *dequeue_wait_time(Queue *Q, int tid)
     return NULL;
 }
 
+Thread *dequeue_thread(Queue *Q, Thread *T, int index)
+{
+    Thread *p, *prev = NULL;
+
+    for (p = Q->q[index]; p != NULL; prev = p, p = p->next)
+    {
+        if (p == T)
+        {
+            if (prev)
+                prev->next = p->next;
+            else
+                Q->q[index] = p->next;
+            if (Q->tail[index] == p)
+                Q->tail[index] = prev;
+            p->next = NULL;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/* take a cancelled T off the feedback queue or sync wait queue holding
+ * it; the running thread is on neither and is left to the caller */
+void unlink_thread(Queue *Q, Thread *T)
+{
+    if (T->cold->blocked_on)
+    {
+        wait_remove(T->cold->blocked_on, T);
+        if (T->cold->wait_cancel)
+            T->cold->wait_cancel(T->cold->wait_data);
+    }
+    else
+    {
+        dequeue_thread(Q, T, get_queue_idx(T->state, T->c_priority, T->event_id));
+    }
+}
+
+/* change c_priority and move T to the list that matches it */
+void change_priority(Queue *Q, Thread *T, Prior priority)
+{
+    WaitQueue *W;
+
+    if ((W = T->cold->blocked_on))
+    {
+        wait_remove(W, T);
+        T->c_priority = priority;
+        wait_enqueue(W, T);
+    }
+    else if (T->state == READY || T->state == WAITING)
+    {
+        dequeue_thread(Q, T, get_queue_idx(T->state, T->c_priority, T->event_id));
+        T->c_priority = priority;
+        enqueue(Q, T, T->state, T->event_id);
+    }
+    else
+    {
+        T->c_priority = priority;
+    }
+}
+
+/* one tick of msec for every thread but the running one */
+void age_threads(Queue *Q, int msec)
+{
+    Thread *p;
+
+    /* increment queue_time and wait_time, walking the TCB table in
+     * slot order rather than chasing the queue links */
+    for (p = Q->threads; p < Q->threads + Q->n_slots; ++p)
+    {
+        if (p->state == READY)
+        {
+            p->queue_time += msec;
+        }
+        if (p->state == WAITING)
+        {
+            p->wait_time += msec;
+        }
+    }
+
+    for (p = Q->q[WAIT_TIME]; p != NULL; p = p->next)
+    {
+        p->timer -= msec;
+    }
+}
+
+/* make the first WAIT_TIME thread whose timer ran out ready, NULL if none */
+Thread *wake_expired_thread(Queue *Q)
+{
+    Thread *p;
+    int tid;
+
+    if ((tid = next_wait_timeout_thread(Q)) < 0)
+        return NULL;
+
+    p = dequeue_wait_time(Q, tid);
+    p->timer = 0;
+    p->event_id = 0;
+    p->state = READY;
+    enqueue(Q, p, READY, 0);
+    return p;
+}
+
 int next_wait_timeout_thread(Queue *Q)
 {
     Thread *p;
@@ -229,4 +432,95 @@ int next_wait_timeout_thread(Queue *Q)
         }
     }
     return -1;
-}
\ No newline at end of file
+}
+
+/* FNV-1a over the tids of every queue in order, sync wait queues excluded */
+unsigned int queue_digest(Queue *Q)
+{
+    unsigned int h = 2166136261u;
+    Thread *p;
+
+    for (int i = 0; i < N_QUEUES; ++i)
+    {
+        if (!Q->q[i])
+            continue;
+        h = (h ^ i) * 16777619u;
+        for (p = Q->q[i]; p != NULL; p = p->next)
+            h = (h ^ p->tid) * 16777619u;
+    }
+    return h;
+}
+
+void register_wait_queue(Queue *Q, WaitQueue *W, WaitOrder order)
+{
+    W->head = NULL;
+    W->order = order;
+    W->next = Q->wait_queues;
+    Q->wait_queues = W;
+}
+
+void unregister_wait_queue(Queue *Q, WaitQueue *W)
+{
+    WaitQueue **pp;
+
+    for (pp = &Q->wait_queues; *pp != NULL; pp = &(*pp)->next)
+    {
+        if (*pp == W)
+        {
+            *pp = W->next;
+            W->next = NULL;
+            return;
+        }
+    }
+}
+
+void wait_enqueue(WaitQueue *W, Thread *T)
+{
+    Thread **pp = &W->head;
+
+    if (W->order == WAIT_PRIORITY)
+    {
+        // insert behind every waiter of the same or higher priority
+        while (*pp != NULL && (*pp)->c_priority <= T->c_priority)
+            pp = &(*pp)->next;
+    }
+    else
+    {
+        while (*pp != NULL)
+            pp = &(*pp)->next;
+    }
+
+    T->next = *pp;
+    *pp = T;
+    T->cold->blocked_on = W;
+}
+
+Thread *wait_dequeue(WaitQueue *W)
+{
+    Thread *p;
+
+    if ((p = W->head))
+    {
+        W->head = p->next;
+        p->next = NULL;
+        p->cold->blocked_on = NULL;
+    }
+    return p;
+}
+
+int wait_remove(WaitQueue *W, Thread *T)
+{
+    Thread **pp;
+
+    for (pp = &W->head; *pp != NULL; pp = &(*pp)->next)
+    {
+        if (*pp == T)
+        {
+            *pp = T->next;
+            T->next = NULL;
+            T->cold->blocked_on = NULL;
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -9,7 +9,11 @@
 #define MEDIUM_TQ 200
 #define LOW_TQ 300
 #define MAX_STR_LEN 128
-#define MAX_THREAD_NUM 64
+#ifndef MAX_THREAD_NUM
+#define MAX_THREAD_NUM 16384 // TCB slots preallocated per Queue
+#endif
+#define CACHE_LINE 64
+#define N_TLS_SLOTS 8 // green-thread-local values per thread
 
 #include <ucontext.h>
 #include <stdbool.h>
@@ -23,6 +27,7 @@ typedef enum
 
 typedef enum
 {
+    UNUSED = -2, // free TCB slot
     RUNNING = -1,
     READY = 0,      // ready
     WAITING = 1,    // waiting
@@ -30,42 +35,104 @@ typedef enum
     TERMINATED = 28 // terminated
 } State;
 
-typedef struct thread_t
+typedef enum
+{
+    WAIT_FIFO = 0,    // wake in arrival order
+    WAIT_PRIORITY = 1 // wake by c_priority, FIFO within a level
+} WaitOrder;
+
+struct wait_queue_t;
+struct spawn_block_t;
+struct os2021_mutex_t;
+
+/* fields only touched when a thread is created, blocks, switches or is
+ * printed; kept apart so scheduler walks stay within the hot records */
+typedef struct thread_cold_t
 {
-    int tid;
-    State state;
     char name[MAX_STR_LEN];
     char p_func[MAX_STR_LEN];
+    int cancel_mode;
+    struct wait_queue_t *blocked_on; // sync object wait queue, NULL if none
+    void *wait_data; // per-wait payload owned by the blocking call
+    void (*wait_cancel)(void *wait_data); // undoes the blocking call's bookkeeping on cancel
+    struct os2021_mutex_t *owned; // mutexes held, most recent first
+    Prior unboosted_priority;     // c_priority before the inheritance still in effect
+    void *script;    // workload script state for the Script entry, NULL otherwise
+    int cpu_time;    // ms of CPU charged by the timer
+    void *tls[N_TLS_SLOTS]; // OS2021_TLSGet/Set values, indexed by key
+    void (*entry)(void);         // p_func resolved at creation, called by thread_start
+    struct spawn_block_t *spawn; // batch owning the stack, NULL if malloc'd alone
+    bool spawn_pending;          // ctx is still to be cloned from spawn->ctx
     ucontext_t ctx;
+} ThreadCold;
+
+/* everything the scheduler reads on a tick or a queue walk, one cache line */
+typedef struct thread_t
+{
+    struct thread_t *next;
+    ThreadCold *cold;
+    int tid;
+    State state;
     Prior b_priority; // base priority
     Prior c_priority; // current priority
-    int cancel_mode;
-    bool am_cancelled;
     int event_id;
-    int queue_time;
-    int wait_time;
     int elapsed;
     int timer; // timer for thread wait time
-    struct thread_t *next;
-} Thread;
+    int queue_time;
+    int wait_time;
+    int preempt_off; // critical section nesting depth, see API_ENTER
+    int idle_quanta; // consecutive quanta without an API call
+    bool am_cancelled;
+    bool api_active; // called into the API during the current quantum
+} __attribute__((aligned(CACHE_LINE))) Thread;
+
+typedef struct wait_queue_t
+{
+    Thread *head;
+    WaitOrder order;
+    struct wait_queue_t *next; // next registered wait queue
+} WaitQueue;
 
 typedef struct queue_t
 {
     Thread **q;
+    Thread **tail;          // last thread of each q[i], NULL when empty
+    WaitQueue *wait_queues; // wait queues of live sync objects
+    Thread *threads;        // MAX_THREAD_NUM hot records, contiguous
+    ThreadCold *cold;       // cold half of threads[i] is cold[i]
+    int *free_slots;        // indices of freed slots, used as a stack
+    int n_free;
+    int n_slots;            // slots handed out so far, the rest were never used
 } Queue;
 
 Queue *create_queue(void);
-Thread *init_thread(int tid,
+void free_queue(Queue *Q);
+Thread *init_thread(Queue *Q,
+                    int tid,
                     char *name,
                     char *p_func,
                     Prior b_priority,
                     int cancel_mode);
+void free_thread(Queue *Q, Thread *T);
 int get_queue_idx(State Q_type, Prior c_priority, int event_id);
 int fill_thread_id_list(Queue *Q, Thread *Running, Thread **list);
 int enqueue(Queue *Q, Thread *T, State Q_type, int event_id);
+int enqueue_head(Queue *Q, Thread *T, State Q_type, int event_id);
+void enqueue_batch(Queue *Q, Thread *first, Thread *last, State Q_type, int event_id);
 Thread *dequeue(Queue *Q, State Q_type, Prior c_priority, int event_id);
 Thread *dequeue_set_event(Queue *Q, int event_id);
 Thread *dequeue_wait_time(Queue *Q, int tid);
+Thread *dequeue_thread(Queue *Q, Thread *T, int index);
+void unlink_thread(Queue *Q, Thread *T);
+void change_priority(Queue *Q, Thread *T, Prior priority);
+void age_threads(Queue *Q, int msec);
+Thread *wake_expired_thread(Queue *Q);
 int next_wait_timeout_thread(Queue *Q);
+unsigned int queue_digest(Queue *Q);
+void register_wait_queue(Queue *Q, WaitQueue *W, WaitOrder order);
+void unregister_wait_queue(Queue *Q, WaitQueue *W);
+void wait_enqueue(WaitQueue *W, Thread *T);
+Thread *wait_dequeue(WaitQueue *W);
+int wait_remove(WaitQueue *W, Thread *T);
 
 #endif
@@ -18,7 +18,8 @@ void Function1(void)
         OS2021_ThreadWaitEvent(3);
         ((i>0) ? OS2021_ThreadCancel("random_1"): "");
         ((j>0) ? OS2021_ThreadCancel("random_2"): "");
-        while(1);
+        while(1)
+            OS2021_ThreadYield();
     }
 }
 
@@ -64,7 +65,8 @@ void Function4(void)
         fprintf(stdout,"I found 65409.\n");
         fflush(stdout);
         OS2021_ThreadSetEvent(6);
-        while(1);
+        while(1)
+            OS2021_ThreadYield();
     }
 }
 
@@ -84,5 +86,6 @@ void ResourceReclaim(void)
     while(1)
     {
         OS2021_DeallocateThreadResource();
+        OS2021_ThreadYield();
     }
 }
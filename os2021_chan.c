@@ -0,0 +1,294 @@
+#include "os2021_thread_api.h"
+
+/* what a thread blocked in send/recv hands to the thread that completes it */
+typedef struct chan_xfer_t
+{
+    void *msg;
+    int status;
+} ChanXfer;
+
+typedef struct select_wait_t
+{
+    OS2021_ChanCase *cases;
+    int n;
+} SelectWait;
+
+static WaitQueue select_waiters; // parked OS2021_ChanSelect callers
+static bool select_waiters_registered = false;
+static unsigned int select_start = 0; // rotates so no case is always polled first
+
+static bool select_watches(SelectWait *w, OS2021_Chan *ch)
+{
+    for (int i = 0; i < w->n; ++i)
+    {
+        if (w->cases[i].chan == ch)
+            return true;
+    }
+    return false;
+}
+
+static void watch_channels(SelectWait *w, int delta)
+{
+    for (int i = 0; i < w->n; ++i)
+        w->cases[i].chan->selectors += delta;
+}
+
+/* wait_cancel hook: a cancelled selector never returns to chan_select */
+static void cancel_select(void *wait_data)
+{
+    watch_channels(wait_data, -1);
+}
+
+/* wake parked selectors watching ch so they poll their cases again */
+static void notify_selectors(OS2021_Chan *ch)
+{
+    Thread *p, *next;
+
+    if (ch->selectors == 0)
+        return;
+
+    for (p = select_waiters.head; p != NULL; p = next)
+    {
+        next = p->next;
+        if (select_watches(p->cold->wait_data, ch))
+        {
+            wait_remove(&select_waiters, p);
+            wake_thread(p);
+        }
+    }
+}
+
+static int chan_try_send(OS2021_Chan *ch, void *msg)
+{
+    Thread *R;
+    ChanXfer *xfer;
+
+    if (ch->closed)
+        return OS2021_CHAN_CLOSED;
+
+    if ((R = wait_dequeue(&ch->receivers)))
+    {
+        xfer = R->cold->wait_data;
+        xfer->msg = msg;
+        xfer->status = OS2021_CHAN_OK;
+        handoff_to_thread(R);
+        return OS2021_CHAN_OK;
+    }
+
+    if (ch->count < ch->capacity)
+    {
+        ch->buf[(ch->head + ch->count) % ch->capacity] = msg;
+        ch->count++;
+        notify_selectors(ch);
+        return OS2021_CHAN_OK;
+    }
+
+    return OS2021_CHAN_WOULDBLOCK;
+}
+
+static int chan_try_recv(OS2021_Chan *ch, void **msg)
+{
+    Thread *S;
+    ChanXfer *xfer;
+
+    if (ch->count > 0)
+    {
+        *msg = ch->buf[ch->head];
+        ch->head = (ch->head + 1) % ch->capacity;
+        ch->count--;
+
+        // the freed slot goes to the oldest blocked sender, if any
+        if ((S = wait_dequeue(&ch->senders)))
+        {
+            xfer = S->cold->wait_data;
+            ch->buf[(ch->head + ch->count) % ch->capacity] = xfer->msg;
+            ch->count++;
+            xfer->status = OS2021_CHAN_OK;
+            wake_thread(S);
+        }
+        else
+        {
+            notify_selectors(ch);
+        }
+        return OS2021_CHAN_OK;
+    }
+
+    if (ch->closed)
+    {
+        *msg = NULL;
+        return OS2021_CHAN_CLOSED;
+    }
+
+    return OS2021_CHAN_WOULDBLOCK;
+}
+
+int OS2021_ChanInit(OS2021_Chan *ch, int capacity)
+{
+    if (capacity < 1 || !(ch->buf = malloc(sizeof(void *) * capacity)))
+        return -1;
+
+    API_ENTER();
+    if (!select_waiters_registered)
+    {
+        register_wait_queue(Q, &select_waiters, WAIT_FIFO);
+        select_waiters_registered = true;
+    }
+
+    ch->capacity = capacity;
+    ch->head = 0;
+    ch->count = 0;
+    ch->selectors = 0;
+    ch->closed = false;
+    register_wait_queue(Q, &ch->senders, WAIT_FIFO);
+    register_wait_queue(Q, &ch->receivers, WAIT_FIFO);
+    API_EXIT();
+    return 0;
+}
+
+int OS2021_ChanDestroy(OS2021_Chan *ch)
+{
+    if (ch->senders.head || ch->receivers.head || ch->selectors)
+        return -1;
+
+    API_ENTER();
+    unregister_wait_queue(Q, &ch->senders);
+    unregister_wait_queue(Q, &ch->receivers);
+    API_EXIT();
+    free(ch->buf);
+    ch->buf = NULL;
+    return 0;
+}
+
+void OS2021_ChanClose(OS2021_Chan *ch)
+{
+    Thread *T;
+    ChanXfer *xfer;
+
+    API_ENTER();
+
+    ch->closed = true;
+
+    while ((T = wait_dequeue(&ch->receivers)))
+    {
+        xfer = T->cold->wait_data;
+        xfer->msg = NULL;
+        xfer->status = OS2021_CHAN_CLOSED;
+        wake_thread(T);
+    }
+    while ((T = wait_dequeue(&ch->senders)))
+    {
+        xfer = T->cold->wait_data;
+        xfer->status = OS2021_CHAN_CLOSED;
+        wake_thread(T);
+    }
+    notify_selectors(ch);
+
+    API_EXIT();
+}
+
+int OS2021_ChanSend(OS2021_Chan *ch, void *msg)
+{
+    ChanXfer xfer = {msg, OS2021_CHAN_OK};
+    int status;
+
+    API_ENTER();
+
+    if ((status = chan_try_send(ch, msg)) == OS2021_CHAN_WOULDBLOCK)
+    {
+        Running->cold->wait_data = &xfer;
+        block_on_wait_queue(&ch->senders);
+        Running->cold->wait_data = NULL;
+        status = xfer.status;
+    }
+
+    API_EXIT();
+    return status;
+}
+
+int OS2021_ChanRecv(OS2021_Chan *ch, void **msg)
+{
+    ChanXfer xfer = {NULL, OS2021_CHAN_OK};
+    int status;
+
+    API_ENTER();
+
+    if ((status = chan_try_recv(ch, msg)) == OS2021_CHAN_WOULDBLOCK)
+    {
+        Running->cold->wait_data = &xfer;
+        block_on_wait_queue(&ch->receivers);
+        Running->cold->wait_data = NULL;
+        *msg = xfer.msg;
+        status = xfer.status;
+    }
+
+    API_EXIT();
+    return status;
+}
+
+int OS2021_ChanTrySend(OS2021_Chan *ch, void *msg)
+{
+    int status;
+
+    API_ENTER();
+    status = chan_try_send(ch, msg);
+    API_EXIT();
+    return status;
+}
+
+int OS2021_ChanTryRecv(OS2021_Chan *ch, void **msg)
+{
+    int status;
+
+    API_ENTER();
+    status = chan_try_recv(ch, msg);
+    API_EXIT();
+    return status;
+}
+
+static int chan_select(OS2021_ChanCase *cases, int n, bool block)
+{
+    SelectWait w = {cases, n};
+    int i, k, start;
+
+    if (n <= 0)
+        return OS2021_CHAN_WOULDBLOCK;
+
+    while (1)
+    {
+        start = select_start++ % n;
+        for (k = 0; k < n; ++k)
+        {
+            i = (start + k) % n;
+            if (cases[i].op == OS2021_CHAN_SEND)
+                cases[i].status = chan_try_send(cases[i].chan, cases[i].msg);
+            else
+                cases[i].status = chan_try_recv(cases[i].chan, &cases[i].msg);
+
+            if (cases[i].status != OS2021_CHAN_WOULDBLOCK)
+                return i;
+        }
+
+        if (!block)
+            return OS2021_CHAN_WOULDBLOCK;
+
+        watch_channels(&w, 1);
+        Running->cold->wait_data = &w;
+        Running->cold->wait_cancel = cancel_select;
+        block_on_wait_queue(&select_waiters);
+        Running->cold->wait_data = NULL;
+        Running->cold->wait_cancel = NULL;
+        watch_channels(&w, -1);
+    }
+}
+
+/* returns the index of the case that fired, or OS2021_CHAN_WOULDBLOCK when
+ * nothing is ready and block is false */
+int OS2021_ChanSelect(OS2021_ChanCase *cases, int n, bool block)
+{
+    int fired;
+
+    API_ENTER();
+    fired = chan_select(cases, n, block);
+    API_EXIT();
+    return fired;
+}
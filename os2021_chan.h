@@ -0,0 +1,78 @@
+#ifndef OS2021_CHAN_H
+#define OS2021_CHAN_H
+
+#define OS2021_CHAN_OK 0
+#define OS2021_CHAN_CLOSED -1
+#define OS2021_CHAN_WOULDBLOCK -2
+
+#define OS2021_CHAN_SEND 0
+#define OS2021_CHAN_RECV 1
+
+#include "feedback_queue.h"
+
+/* bounded ring of pointers; messages are passed by reference, never copied */
+typedef struct os2021_chan_t
+{
+    void **buf;
+    int capacity;
+    int head;  // next slot to receive from
+    int count; // messages in buf
+    int selectors; // parked OS2021_ChanSelect callers watching this channel
+    bool closed;
+    WaitQueue senders;   // blocked on a full channel
+    WaitQueue receivers; // blocked on an empty channel
+} OS2021_Chan;
+
+typedef struct os2021_chan_case_t
+{
+    OS2021_Chan *chan;
+    int op;     // OS2021_CHAN_SEND or OS2021_CHAN_RECV
+    void *msg;  // message to send, or the message received
+    int status; // result of the case that fired
+} OS2021_ChanCase;
+
+int OS2021_ChanInit(OS2021_Chan *ch, int capacity);
+int OS2021_ChanDestroy(OS2021_Chan *ch);
+void OS2021_ChanClose(OS2021_Chan *ch);
+int OS2021_ChanSend(OS2021_Chan *ch, void *msg);
+int OS2021_ChanRecv(OS2021_Chan *ch, void **msg);
+int OS2021_ChanTrySend(OS2021_Chan *ch, void *msg);
+int OS2021_ChanTryRecv(OS2021_Chan *ch, void **msg);
+int OS2021_ChanSelect(OS2021_ChanCase *cases, int n, bool block);
+
+/* declares NAME, a channel carrying TYPE *, with type-checked wrappers */
+#define OS2021_CHAN_DECLARE(NAME, TYPE)                                 \
+    typedef struct                                                      \
+    {                                                                   \
+        OS2021_Chan chan;                                               \
+    } NAME;                                                             \
+    static inline int NAME##_Init(NAME *c, int capacity)                \
+    {                                                                   \
+        return OS2021_ChanInit(&c->chan, capacity);                     \
+    }                                                                   \
+    static inline int NAME##_Destroy(NAME *c)                           \
+    {                                                                   \
+        return OS2021_ChanDestroy(&c->chan);                            \
+    }                                                                   \
+    static inline void NAME##_Close(NAME *c)                            \
+    {                                                                   \
+        OS2021_ChanClose(&c->chan);                                     \
+    }                                                                   \
+    static inline int NAME##_Send(NAME *c, TYPE *msg)                   \
+    {                                                                   \
+        return OS2021_ChanSend(&c->chan, msg);                          \
+    }                                                                   \
+    static inline int NAME##_Recv(NAME *c, TYPE **msg)                  \
+    {                                                                   \
+        return OS2021_ChanRecv(&c->chan, (void **)msg);                 \
+    }                                                                   \
+    static inline int NAME##_TrySend(NAME *c, TYPE *msg)                \
+    {                                                                   \
+        return OS2021_ChanTrySend(&c->chan, msg);                       \
+    }                                                                   \
+    static inline int NAME##_TryRecv(NAME *c, TYPE **msg)               \
+    {                                                                   \
+        return OS2021_ChanTryRecv(&c->chan, (void **)msg);              \
+    }
+
+#endif
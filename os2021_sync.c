@@ -0,0 +1,340 @@
+#include "os2021_thread_api.h"
+
+static WaitOrder wait_order(int flags)
+{
+    return (flags & OS2021_SYNC_PRIORITY) ? WAIT_PRIORITY : WAIT_FIFO;
+}
+
+static bool holds_boosted_mutex(Thread *T)
+{
+    OS2021_Mutex *m;
+
+    for (m = T->cold->owned; m != NULL; m = m->next_owned)
+    {
+        if (m->boosted)
+            return true;
+    }
+    return false;
+}
+
+/* raise the owner of m to the best priority among its waiters; m counts
+ * as boosted whenever a waiter outranks the owner's own priority, even if
+ * another mutex already lifted the owner that high */
+static void inherit_priority(OS2021_Mutex *m)
+{
+    Thread *p, *owner = m->owner;
+    bool boosted = holds_boosted_mutex(owner);
+    Prior own = boosted ? owner->cold->unboosted_priority : owner->c_priority;
+    Prior best = own;
+
+    for (p = m->waiters.head; p != NULL; p = p->next)
+    {
+        if (p->c_priority < best)
+            best = p->c_priority;
+    }
+
+    if (best < own)
+    {
+        if (!boosted)
+            owner->cold->unboosted_priority = owner->c_priority;
+        m->boosted = true;
+        if (best < owner->c_priority)
+            set_thread_priority(owner, best);
+    }
+}
+
+/* T stopped being lent priority through one mutex: fall back to its own
+ * priority, or to the best one still lent through the mutexes it holds */
+static void drop_inherited_priority(Thread *T)
+{
+    Prior floor = inherited_priority_floor(T);
+
+    set_thread_priority(T, floor < T->cold->unboosted_priority ? floor : T->cold->unboosted_priority);
+}
+
+static void give_mutex(OS2021_Mutex *m, Thread *T)
+{
+    m->owner = T;
+    m->next_owned = T->cold->owned;
+    T->cold->owned = m;
+}
+
+static void take_mutex_from_owner(OS2021_Mutex *m)
+{
+    OS2021_Mutex **pp;
+
+    for (pp = &m->owner->cold->owned; *pp != NULL; pp = &(*pp)->next_owned)
+    {
+        if (*pp == m)
+        {
+            *pp = m->next_owned;
+            break;
+        }
+    }
+    m->next_owned = NULL;
+    m->owner = NULL;
+}
+
+/* the lowest level MLFQ may demote T to: while T holds a boosted mutex
+ * it keeps the priority of that mutex's best waiter */
+Prior inherited_priority_floor(Thread *T)
+{
+    OS2021_Mutex *m;
+    Thread *p;
+    Prior floor = LOW;
+
+    for (m = T->cold->owned; m != NULL; m = m->next_owned)
+    {
+        if (!m->boosted)
+            continue;
+        for (p = m->waiters.head; p != NULL; p = p->next)
+        {
+            if (p->c_priority < floor)
+                floor = p->c_priority;
+        }
+    }
+    return floor;
+}
+
+/* m was just released: hand it to its next waiter, if any */
+static void pass_mutex(OS2021_Mutex *m)
+{
+    Thread *T;
+
+    if ((T = wait_dequeue(&m->waiters)))
+    {
+        give_mutex(m, T);
+        wake_thread(T);
+        if (m->flags & OS2021_MUTEX_INHERIT)
+            inherit_priority(m);
+    }
+}
+
+/* give m to T if it is free, otherwise park T on the mutex */
+static void requeue_on_mutex(OS2021_Mutex *m, Thread *T)
+{
+    if (!m->owner)
+    {
+        give_mutex(m, T);
+        wake_thread(T);
+    }
+    else
+    {
+        wait_enqueue(&m->waiters, T);
+        if (m->flags & OS2021_MUTEX_INHERIT)
+            inherit_priority(m);
+    }
+}
+
+void OS2021_MutexInit(OS2021_Mutex *m, int flags)
+{
+    m->owner = NULL;
+    m->flags = flags;
+    m->boosted = false;
+    m->next_owned = NULL;
+    API_ENTER();
+    register_wait_queue(Q, &m->waiters, wait_order(flags));
+    API_EXIT();
+}
+
+int OS2021_MutexDestroy(OS2021_Mutex *m)
+{
+    if (m->owner || m->waiters.head)
+        return -1;
+
+    API_ENTER();
+    unregister_wait_queue(Q, &m->waiters);
+    API_EXIT();
+    return 0;
+}
+
+void OS2021_MutexLock(OS2021_Mutex *m)
+{
+    API_ENTER();
+
+    if (!m->owner)
+    {
+        give_mutex(m, Running);
+        API_EXIT();
+        return;
+    }
+
+    prepare_block();
+    wait_enqueue(&m->waiters, Running);
+    if (m->flags & OS2021_MUTEX_INHERIT)
+        inherit_priority(m);
+    switch_to_dispatcher();
+    // the unlocking thread handed m over, so we own it here
+    API_EXIT();
+}
+
+int OS2021_MutexTryLock(OS2021_Mutex *m)
+{
+    API_ENTER();
+
+    if (m->owner)
+    {
+        API_EXIT();
+        return -1;
+    }
+
+    give_mutex(m, Running);
+    API_EXIT();
+    return 0;
+}
+
+int OS2021_MutexUnlock(OS2021_Mutex *m)
+{
+    API_ENTER();
+
+    if (m->owner != Running)
+    {
+        API_EXIT();
+        return -1;
+    }
+
+    take_mutex_from_owner(m);
+    if (m->boosted)
+    {
+        m->boosted = false;
+        drop_inherited_priority(Running);
+    }
+    pass_mutex(m);
+
+    API_EXIT();
+    return 0;
+}
+
+/* T exited or was cancelled while holding mutexes: pass each one on so
+ * its waiters don't wait on a reclaimed slot forever */
+void release_owned_mutexes(Thread *T)
+{
+    OS2021_Mutex *m;
+
+    while ((m = T->cold->owned))
+    {
+        take_mutex_from_owner(m);
+        m->boosted = false;
+        pass_mutex(m);
+    }
+}
+
+void OS2021_CondInit(OS2021_Cond *c, int flags)
+{
+    c->mutex = NULL;
+    API_ENTER();
+    register_wait_queue(Q, &c->waiters, wait_order(flags));
+    API_EXIT();
+}
+
+int OS2021_CondDestroy(OS2021_Cond *c)
+{
+    if (c->waiters.head)
+        return -1;
+
+    API_ENTER();
+    unregister_wait_queue(Q, &c->waiters);
+    API_EXIT();
+    return 0;
+}
+
+void OS2021_CondWait(OS2021_Cond *c, OS2021_Mutex *m)
+{
+    API_ENTER();
+
+    c->mutex = m;
+    prepare_block();
+    wait_enqueue(&c->waiters, Running);
+    OS2021_MutexUnlock(m);
+    switch_to_dispatcher();
+    // signalled waiters are moved onto m and woken as its owner
+    API_EXIT();
+}
+
+void OS2021_CondSignal(OS2021_Cond *c)
+{
+    Thread *T;
+
+    API_ENTER();
+
+    if ((T = wait_dequeue(&c->waiters)))
+        requeue_on_mutex(c->mutex, T);
+
+    API_EXIT();
+}
+
+void OS2021_CondBroadcast(OS2021_Cond *c)
+{
+    Thread *T;
+
+    API_ENTER();
+
+    while ((T = wait_dequeue(&c->waiters)))
+        requeue_on_mutex(c->mutex, T);
+
+    API_EXIT();
+}
+
+void OS2021_SemInit(OS2021_Sem *s, int count, int flags)
+{
+    s->count = count;
+    API_ENTER();
+    register_wait_queue(Q, &s->waiters, wait_order(flags));
+    API_EXIT();
+}
+
+int OS2021_SemDestroy(OS2021_Sem *s)
+{
+    if (s->waiters.head)
+        return -1;
+
+    API_ENTER();
+    unregister_wait_queue(Q, &s->waiters);
+    API_EXIT();
+    return 0;
+}
+
+void OS2021_SemWait(OS2021_Sem *s)
+{
+    API_ENTER();
+
+    if (s->count > 0)
+    {
+        s->count--;
+        API_EXIT();
+        return;
+    }
+
+    block_on_wait_queue(&s->waiters);
+    // OS2021_SemPost passed its unit straight to us
+    API_EXIT();
+}
+
+int OS2021_SemTryWait(OS2021_Sem *s)
+{
+    API_ENTER();
+
+    if (s->count <= 0)
+    {
+        API_EXIT();
+        return -1;
+    }
+
+    s->count--;
+    API_EXIT();
+    return 0;
+}
+
+void OS2021_SemPost(OS2021_Sem *s)
+{
+    Thread *T;
+
+    API_ENTER();
+
+    if ((T = wait_dequeue(&s->waiters)))
+        wake_thread(T);
+    else
+        s->count++;
+
+    API_EXIT();
+}
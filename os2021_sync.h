@@ -0,0 +1,51 @@
+#ifndef OS2021_SYNC_H
+#define OS2021_SYNC_H
+
+#define OS2021_SYNC_PRIORITY 0x1 // wake waiters by c_priority instead of FIFO
+#define OS2021_MUTEX_INHERIT 0x2 // owner inherits the priority of its best waiter
+
+#include "feedback_queue.h"
+
+typedef struct os2021_mutex_t
+{
+    Thread *owner;
+    int flags;
+    bool boosted;          // a waiter lends the owner its priority
+    WaitQueue waiters;
+    struct os2021_mutex_t *next_owned; // next mutex held by the same owner
+} OS2021_Mutex;
+
+typedef struct os2021_cond_t
+{
+    OS2021_Mutex *mutex; // mutex the waiters released, set by OS2021_CondWait
+    WaitQueue waiters;
+} OS2021_Cond;
+
+typedef struct os2021_sem_t
+{
+    int count;
+    WaitQueue waiters;
+} OS2021_Sem;
+
+void OS2021_MutexInit(OS2021_Mutex *m, int flags);
+int OS2021_MutexDestroy(OS2021_Mutex *m);
+void OS2021_MutexLock(OS2021_Mutex *m);
+int OS2021_MutexTryLock(OS2021_Mutex *m);
+int OS2021_MutexUnlock(OS2021_Mutex *m);
+
+void OS2021_CondInit(OS2021_Cond *c, int flags);
+int OS2021_CondDestroy(OS2021_Cond *c);
+void OS2021_CondWait(OS2021_Cond *c, OS2021_Mutex *m);
+void OS2021_CondSignal(OS2021_Cond *c);
+void OS2021_CondBroadcast(OS2021_Cond *c);
+
+void OS2021_SemInit(OS2021_Sem *s, int count, int flags);
+int OS2021_SemDestroy(OS2021_Sem *s);
+void OS2021_SemWait(OS2021_Sem *s);
+int OS2021_SemTryWait(OS2021_Sem *s);
+void OS2021_SemPost(OS2021_Sem *s);
+
+Prior inherited_priority_floor(Thread *T);
+void release_owned_mutexes(Thread *T);
+
+#endif
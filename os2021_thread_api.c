@@ -1,11 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <json-c/json.h>
 #include "os2021_thread_api.h"
+#include "workload.h"
 
-#define JSON_BUF_SIZE 4096
 #define MAX_STR_LEN 128
-#define MAX_THREAD_NUM 64
 #define IT_INTERVAL_MSEC 10
 #define USEC_TO_MSEC 1000
 
@@ -28,7 +28,23 @@ struct sigaction sa;
 struct itimerval Signaltimer;
 ucontext_t dispatch_ctx;
 ucontext_t timeout_ctx;
-void (*func[6])() = {Function1, Function2, Function3, Function4, Function5, ResourceReclaim};
+void (*func[7])() = {Function1, Function2, Function3, Function4, Function5, ResourceReclaim, Script};
+
+volatile sig_atomic_t preempt_pending = 0;  // tick arrived inside a critical section
+volatile sig_atomic_t status_requested = 0; // SIGTSTP, served on the next tick
+volatile sig_atomic_t stop_requested = 0;   // SIGINT while tracing, served on the next tick
+
+long tick_count = 0;   // SIGALRM ticks handled so far
+long switch_count = 0; // dispatches plus direct handoffs
+int snapshot_ticks = 0; // publish a shm snapshot every this many ticks, 0 = off
+
+int spin_quanta = 0;    // idle quanta before a thread counts as spinning, 0 = off
+int spin_park_msec = 0; // how long to park a spinning thread, 0 = demote instead
+
+const char *config_file = "init_threads.json";
+const char *trace_file = NULL; // record scheduling decisions here, NULL = off
+bool tracing = false;
+int run_msec = 0; // stop and print the workload summary after this long, 0 = never
 
 char running[] = "Running";
 char ready[] = "Ready";
@@ -36,135 +52,529 @@ char waiting[] = "Waiting";
 
 int OS2021_ThreadCreate(char *job_name, char *p_function, char *priority, int cancel_mode)
 {
-    if (!p_function_is_valid(p_function))
+    API_ENTER();
+
+    Thread *T = create_thread(job_name, p_function, priority, cancel_mode);
+
+    API_EXIT();
+    return T ? tid_counter : -1;
+}
+
+/* validate and resolve once, carve every stack out of one block and
+ * splice the batch into the ready queue in one step; contexts are cloned
+ * lazily so no stack page is touched until the thread first runs */
+int OS2021_ThreadCreateMany(const OS2021_ThreadTemplate *tpl, int count, const char *name_prefix)
+{
+    SpawnBlock *block;
+    Thread *T, *first = NULL, *last = NULL;
+    char name[MAX_STR_LEN];
+    int prefix_len;
+    size_t stack_size;
+    void (*entry)(void);
+    int created, p;
+
+    API_ENTER();
+
+    if (count <= 0 || !p_function_is_valid(tpl->p_function))
+    {
+        API_EXIT();
         return -1;
+    }
 
-    int p = priority_stoi(priority);
-    Thread *T = init_thread(tid_counter, job_name, p_function, p, cancel_mode);
-    CreateContext(&T->ctx, NULL, get_function_handle(T->p_func));
-    enqueue(Q, T, READY, 0);
+    p = priority_stoi(tpl->priority);
+    stack_size = (stack_size_for(tpl->p_function) + 15) & ~(size_t)15;
+    if (!(block = alloc_spawn_block(stack_size, count)))
+    {
+        API_EXIT();
+        return -1;
+    }
+    getcontext(&block->ctx);
+    block->ctx.uc_link = NULL;
+    entry = get_function_handle(tpl->p_function);
+    prefix_len = snprintf(name, MAX_STR_LEN, "%.100s-", name_prefix);
 
-    tid_counter++;
-    thread_count++;
+    for (created = 0; created < count; ++created)
+    {
+        format_index(name + prefix_len, created);
+        if (!(T = init_thread(Q, tid_counter, name, tpl->p_function, p, tpl->cancel_mode)))
+            break;
+        T->cold->ctx.uc_stack.ss_sp = block->stacks + created * block->stride;
+        T->cold->ctx.uc_stack.ss_size = stack_size;
+        T->cold->ctx.uc_stack.ss_flags = 0;
+        stack_paint(T->cold->ctx.uc_stack.ss_sp, stack_size);
+        T->cold->entry = entry;
+        T->cold->spawn = block;
+        T->cold->spawn_pending = true;
+        T->preempt_off = 1; // see thread_start
+
+        if (last)
+            last->next = T;
+        else
+            first = T;
+        last = T;
+        tid_counter++;
+    }
+
+    block->refs = created;
+    if (created)
+    {
+        enqueue_batch(Q, first, last, READY, 0);
+        trace_event(TRACE_CREATE_BATCH, first, created);
+    }
+    else
+        free_spawn_block(block);
+    thread_count += created;
 
-    return tid_counter;
+    API_EXIT();
+    return created;
+}
+
+void OS2021_ThreadExit(void)
+{
+    API_ENTER();
+
+    Running->state = TERMINATED;
+    enqueue(Q, Running, TERMINATED, 0);
+    trace_event(TRACE_EXIT, Running, 0);
+    swapcontext(&Running->cold->ctx, &dispatch_ctx);
+
+    API_EXIT();
 }
 
 void OS2021_ThreadCancel(char *job_name)
 {
+    API_ENTER();
+
     Thread *T = find_thread_by_name(job_name);
     if (!T)
     {
         printf("Cannot find thread %s to cancel\n", job_name);
         fflush(stdout);
+        API_EXIT();
         return;
     }
 
     T->am_cancelled = true;
 
-    if (T->cancel_mode == 0)
+    if (T->cold->cancel_mode == 0)
     {
-        State original_state = T->state;
-        T->state = TERMINATED;
-        enqueue(Q, T, TERMINATED, 0);
         if (T->tid == Running->tid)
         {
-            swapcontext(&Running->ctx, &dispatch_ctx);
+            T->state = TERMINATED;
+            enqueue(Q, T, TERMINATED, 0);
+            trace_event(TRACE_CANCEL, T, 0);
+            swapcontext(&Running->cold->ctx, &dispatch_ctx);
         }
         else
         {
-            dequeue(Q, original_state, T->c_priority, T->event_id);
+            unlink_thread(Q, T);
+            T->state = TERMINATED;
+            enqueue(Q, T, TERMINATED, 0);
+            trace_event(TRACE_CANCEL, T, 0);
         }
     }
+
+    API_EXIT();
 }
 
 void OS2021_ThreadWaitEvent(int event_id)
 {
-    printf("%s wants to wait for event %d\n", Running->name, event_id);
+    API_ENTER();
+
+    printf("%s wants to wait for event %d\n", Running->cold->name, event_id);
     fflush(stdout);
 
-    int time_quantum = get_time_quantum(Running->c_priority);
-    if (Running->elapsed < time_quantum)
-    {
-        if (Running->c_priority != HIGH)
-        {
-            printf("The priority of %s changed from %d to %d\n",
-                   Running->name, Running->c_priority, Running->c_priority - 1);
-            fflush(stdout);
-            Running->c_priority--;
-        }
-    }
+    promote_if_quantum_unused();
 
     Running->event_id = event_id;
     Running->elapsed = 0;
     Running->state = WAITING;
     enqueue(Q, Running, Running->state, Running->event_id);
-    swapcontext(&Running->ctx, &dispatch_ctx);
+    trace_event(TRACE_WAIT_EVENT, Running, event_id);
+    swapcontext(&Running->cold->ctx, &dispatch_ctx);
+    API_EXIT();
 }
 
 void OS2021_ThreadSetEvent(int event_id)
 {
     Thread *T;
 
+    API_ENTER();
+
     if ((T = dequeue_set_event(Q, event_id)))
     {
         T->state = READY;
         T->event_id = 0;
         enqueue(Q, T, T->state, T->event_id);
-        printf("%s changed the state of %s to READY\n", Running->name, T->name);
+        trace_event(TRACE_SET_EVENT, T, event_id);
+        printf("%s changed the state of %s to READY\n", Running->cold->name, T->cold->name);
         fflush(stdout);
     }
+    else
+    {
+        trace_event(TRACE_SET_EVENT, NULL, event_id);
+    }
+
+    API_EXIT();
 }
 
 void OS2021_ThreadWaitTime(int msec)
 {
-    printf("%s wants to wait for %d ms\n", Running->name, msec * 10);
+    API_ENTER();
+
+    printf("%s wants to wait for %d ms\n", Running->cold->name, msec * 10);
     fflush(stdout);
 
-    int time_quantum = get_time_quantum(Running->c_priority);
-    if (Running->elapsed < time_quantum)
-    {
-        if (Running->c_priority != HIGH)
-        {
-            printf("The priority of %s changed from %d to %d\n",
-                   Running->name, Running->c_priority, Running->c_priority - 1);
-            fflush(stdout);
-            Running->c_priority--;
-        }
-    }
+    promote_if_quantum_unused();
 
     Running->timer = msec * IT_INTERVAL_MSEC;
+    Running->event_id = 8;
     Running->elapsed = 0;
     Running->state = WAITING;
     enqueue(Q, Running, WAITING, 8); // wait time queue is one behind [wait, low, 7]
-    swapcontext(&Running->ctx, &dispatch_ctx);
+    trace_event(TRACE_WAIT_TIME, Running, Running->timer);
+    swapcontext(&Running->cold->ctx, &dispatch_ctx);
+    API_EXIT();
+}
+
+void OS2021_ThreadYield(void)
+{
+    int priority;
+
+    API_ENTER();
+
+    // nothing is ready at our level or above, so the dispatcher would
+    // just pick us straight back
+    for (priority = 0; priority <= Running->c_priority && !Q->q[priority]; ++priority)
+        ;
+    if (priority > Running->c_priority)
+    {
+        API_EXIT();
+        return;
+    }
+
+    // keep c_priority and elapsed: yielding neither earns a promotion nor
+    // resets the quantum, so a yield loop is still demoted on schedule
+    Running->state = READY;
+    Running->event_id = 0;
+    enqueue(Q, Running, READY, 0);
+    trace_event(TRACE_YIELD, Running, 0);
+    swapcontext(&Running->cold->ctx, &dispatch_ctx);
+    API_EXIT();
 }
 
 void OS2021_DeallocateThreadResource()
 {
+    API_ENTER();
+
     Thread *T = dequeue(Q, TERMINATED, 0, 0);
     if (T)
     {
-        free(T->ctx.uc_stack.ss_sp);
-        free(T);
+        trace_event(TRACE_RECLAIM, T, 0);
+        release_owned_mutexes(T);
+        tls_run_destructors(T);
+        stack_record(T->cold->p_func, T->cold->ctx.uc_stack.ss_sp, T->cold->ctx.uc_stack.ss_size);
+        free_stack(T->cold);
+        free(T->cold->script);
+        free_thread(Q, T);
     }
+
+    API_EXIT();
 }
 
 void OS2021_TestCancel()
 {
+    API_ENTER();
+
     if (Running->am_cancelled)
     {
         Running->state = TERMINATED;
         enqueue(Q, Running, TERMINATED, 0);
-        swapcontext(&Running->ctx, &dispatch_ctx);
+        trace_event(TRACE_EXIT, Running, 0);
+        swapcontext(&Running->cold->ctx, &dispatch_ctx);
+    }
+
+    API_EXIT();
+}
+
+void OS2021_EnableSnapshot(int every_n_ticks)
+{
+    snapshot_ticks = every_n_ticks;
+}
+
+void OS2021_SetConfigFile(const char *path)
+{
+    config_file = path;
+}
+
+void OS2021_SetDuration(int msec)
+{
+    run_msec = msec;
+}
+
+void OS2021_EnableStackProfile(bool autosize, int margin_percent)
+{
+    stack_profile_enable(autosize, margin_percent);
+}
+
+void OS2021_EnableTrace(const char *path)
+{
+    trace_file = path;
+}
+
+void OS2021_SetSpinDetector(int n_quanta, int park_msec)
+{
+    spin_quanta = n_quanta;
+    spin_park_msec = park_msec;
+}
+
+/* caller is inside API_ENTER */
+Thread *create_thread(char *job_name, char *p_function, char *priority, int cancel_mode)
+{
+    if (!p_function_is_valid(p_function))
+        return NULL;
+
+    int p = priority_stoi(priority);
+    Thread *T = init_thread(Q, tid_counter, job_name, p_function, p, cancel_mode);
+    if (!T)
+        return NULL;
+    T->cold->entry = get_function_handle(T->cold->p_func);
+    CreateContext(&T->cold->ctx, NULL, thread_start, stack_size_for(T->cold->p_func));
+    T->preempt_off = 1; // see thread_start
+    enqueue(Q, T, READY, 0);
+    trace_event(TRACE_CREATE, T, 0);
+
+    tid_counter++;
+    thread_count++;
+
+    return T;
+}
+
+/* decimal n into buf, the hot part of naming a batch */
+void format_index(char *buf, int n)
+{
+    char digits[12];
+    int len = 0;
+
+    do
+    {
+        digits[len++] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    while (len > 0)
+        *buf++ = digits[--len];
+    *buf = '\0';
+}
+
+/* first code of every thread. Threads are created inside a critical
+ * section: setcontext unmasks SIGALRM before it switches stacks, and a
+ * tick delivered in between would otherwise be charged to the new thread
+ * and save the dispatcher's registers into its context */
+void thread_start(void)
+{
+    API_EXIT();
+    Running->cold->entry();
+}
+
+/* build the context of a thread from OS2021_ThreadCreateMany right before
+ * it first runs; the copy's FP state pointer refers into spawn->ctx,
+ * which lives until the last thread of the batch is reclaimed */
+void start_spawned_context(Thread *T)
+{
+    ThreadCold *cold = T->cold;
+    stack_t stack = cold->ctx.uc_stack;
+
+    cold->ctx = cold->spawn->ctx;
+    cold->ctx.uc_stack = stack;
+    makecontext(&cold->ctx, thread_start, 0);
+    cold->spawn_pending = false;
+}
+
+static size_t page_size(void)
+{
+    static size_t size = 0;
+
+    if (!size)
+        size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+/* autosized stacks come from a few samples, so each one sits on top of a
+ * PROT_NONE page: going deeper than measured faults instead of silently
+ * overwriting whatever lies below */
+void *alloc_stack(size_t size)
+{
+    char *p;
+
+    if (size >= STACK_SIZE)
+        return malloc(size);
+
+    p = mmap(NULL, page_size() + size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    mprotect(p, page_size(), PROT_NONE);
+    return p + page_size();
+}
+
+/* a batch with autosized stacks is mapped like alloc_stack does it, with
+ * a guard page below every stack; the guards are best effort, a batch too
+ * large for the kernel's mapping limit keeps the rest of them unguarded */
+SpawnBlock *alloc_spawn_block(size_t stack_size, int count)
+{
+    SpawnBlock *block;
+    size_t guard = page_size(), header, size;
+    char *p;
+
+    if (stack_size >= STACK_SIZE)
+    {
+        if (!(block = malloc(SPAWN_HEADER_SIZE + stack_size * count)))
+            return NULL;
+        block->stacks = (char *)block + SPAWN_HEADER_SIZE;
+        block->stride = stack_size;
+        block->map_size = 0;
+        return block;
+    }
+
+    header = (SPAWN_HEADER_SIZE + guard - 1) & ~(guard - 1);
+    size = guard + ((stack_size + guard - 1) & ~(guard - 1));
+    p = mmap(NULL, header + size * count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    for (int i = 0; i < count; ++i)
+    {
+        if (mprotect(p + header + i * size, guard, PROT_NONE) != 0)
+            break;
+    }
+
+    block = (SpawnBlock *)p;
+    block->stacks = p + header + guard;
+    block->stride = size;
+    block->map_size = header + size * count;
+    return block;
+}
+
+void free_spawn_block(SpawnBlock *block)
+{
+    if (block->map_size)
+        munmap(block, block->map_size);
+    else
+        free(block);
+}
+
+void free_stack(ThreadCold *cold)
+{
+    char *sp = cold->ctx.uc_stack.ss_sp;
+    size_t size = cold->ctx.uc_stack.ss_size;
+
+    if (cold->spawn)
+    {
+        if (--cold->spawn->refs == 0)
+            free_spawn_block(cold->spawn);
+    }
+    else if (size >= STACK_SIZE)
+        free(sp);
+    else
+        munmap(sp - page_size(), page_size() + size);
+    cold->spawn = NULL;
+}
+
+/* threads that block before using up their time quantum move up one level */
+void promote_if_quantum_unused(void)
+{
+    int time_quantum = get_time_quantum(Running->c_priority);
+    if (Running->elapsed < time_quantum)
+    {
+        if (Running->c_priority != HIGH)
+        {
+            printf("The priority of %s changed from %d to %d\n",
+                   Running->cold->name, Running->c_priority, Running->c_priority - 1);
+            fflush(stdout);
+            Running->c_priority--;
+        }
     }
 }
 
-void CreateContext(ucontext_t *context, ucontext_t *next_context, void *func)
+void prepare_block(void)
+{
+    promote_if_quantum_unused();
+    Running->elapsed = 0;
+    Running->state = WAITING;
+    trace_event(TRACE_BLOCK, Running, 0);
+}
+
+void block_on_wait_queue(WaitQueue *W)
+{
+    prepare_block();
+    wait_enqueue(W, Running);
+    swapcontext(&Running->cold->ctx, &dispatch_ctx);
+}
+
+void switch_to_dispatcher(void)
+{
+    swapcontext(&Running->cold->ctx, &dispatch_ctx);
+}
+
+void wake_thread(Thread *T)
+{
+    T->state = READY;
+    T->event_id = 0;
+    enqueue(Q, T, READY, 0);
+    trace_event(TRACE_WAKE, T, 0);
+}
+
+/* run T right away instead of sending it through the ready queue, as
+ * long as no ready thread outranks it; the caller keeps its place at the
+ * head of its level so it resumes as soon as T gives up the CPU */
+void handoff_to_thread(Thread *T)
+{
+    Thread *prev = Running;
+
+    for (int priority = 0; priority < T->c_priority; ++priority)
+    {
+        if (Q->q[priority])
+        {
+            wake_thread(T);
+            return;
+        }
+    }
+    if (T->c_priority > prev->c_priority)
+    {
+        wake_thread(T);
+        return;
+    }
+
+    T->event_id = 0;
+    T->state = RUNNING;
+    prev->state = READY;
+    enqueue_head(Q, prev, READY, 0);
+    Running = T;
+    switch_count++;
+    trace_event(TRACE_HANDOFF, T, 0);
+    if (T->cold->spawn_pending)
+        start_spawned_context(T);
+    swapcontext(&prev->cold->ctx, &T->cold->ctx);
+}
+
+/* change_priority, logged and traced */
+void set_thread_priority(Thread *T, Prior priority)
+{
+    if (T->c_priority == priority)
+        return;
+
+    printf("The priority of %s changed from %d to %d\n",
+           T->cold->name, T->c_priority, priority);
+    fflush(stdout);
+
+    change_priority(Q, T, priority);
+    trace_event(TRACE_PRIORITY, T, 0);
+}
+
+void CreateContext(ucontext_t *context, ucontext_t *next_context, void *func, size_t stack_size)
 {
     getcontext(context);
-    context->uc_stack.ss_sp = malloc(STACK_SIZE);
-    context->uc_stack.ss_size = STACK_SIZE;
+    context->uc_stack.ss_sp = alloc_stack(stack_size);
+    context->uc_stack.ss_size = stack_size;
+    stack_paint(context->uc_stack.ss_sp, stack_size);
     context->uc_stack.ss_flags = 0;
     context->uc_link = next_context;
     makecontext(context, (void (*)(void))func, 0);
@@ -184,6 +594,8 @@ void (*get_function_handle(const char *p_function))(void)
         return func[4];
     if (strncmp(p_function, "ResourceReclaim", MAX_STR_LEN) == 0)
         return func[5];
+    if (strncmp(p_function, "Script", MAX_STR_LEN) == 0)
+        return func[6];
     return NULL; // should never return null
 }
 
@@ -207,7 +619,7 @@ Thread *find_thread_by_name(const char *name)
 
     for (i = 0; i < count; ++i)
     {
-        if (strncmp(thread_list[i]->name, name, MAX_STR_LEN) == 0)
+        if (strncmp(thread_list[i]->cold->name, name, MAX_STR_LEN) == 0)
             return thread_list[i];
     }
 
@@ -232,6 +644,15 @@ void Dispatcher()
 
     Thread *T;
 
+    /* the previous thread blocked inside a critical section that
+     * deferred a tick; it is still charged for the tick, but its elapsed
+     * time no longer matters */
+    if (preempt_pending)
+    {
+        preempt_pending = false;
+        account_tick();
+    }
+
     for (int priority = 0; priority < N_PRIOR_LVL; ++priority)
     {
         if ((T = dequeue(Q, READY, priority, 0)))
@@ -239,44 +660,80 @@ void Dispatcher()
     }
     Running = T;
     Running->state = RUNNING;
-    //printf("Current running %s\n", Running->name);
+    switch_count++;
+    trace_event(TRACE_DISPATCH, Running, 0);
+    if (Running->cold->spawn_pending)
+        start_spawned_context(Running);
+    //printf("Current running %s\n", Running->cold->name);
     //fflush(stdout);
-    setcontext(&Running->ctx);
+    setcontext(&Running->cold->ctx);
 }
 
-void timeout_handler(void)
+void trace_event(TraceOp op, Thread *T, int arg)
 {
-    /* increment queue_time and wait_time */
-    int count = fill_thread_id_list(Q, Running, thread_list);
-    for (int i = 0; i < count; ++i)
-    {
-        if (thread_list[i]->state == READY)
-        {
-            thread_list[i]->queue_time += IT_INTERVAL_MSEC;
-        }
-        if (thread_list[i]->state == WAITING)
-        {
-            thread_list[i]->wait_time += IT_INTERVAL_MSEC;
-        }
-    }
+    TraceRecord r;
 
-    /* handle wait timeout threads */
+    if (!tracing)
+        return;
+
+    r.tick = tick_count;
+    r.op = op;
+    r.tid = T ? T->tid : -1;
+    r.prio = T ? T->c_priority : 0;
+    r.arg = arg;
+    r.digest = queue_digest(Q);
+    r.reserved = 0;
+    trace_write(&r);
+}
+
+/* end of a timed or interrupted run; atexit flushes the trace */
+void finish_simulation(void)
+{
+    workload_report(tick_count * IT_INTERVAL_MSEC);
+    stack_report(Q);
+    exit(EXIT_SUCCESS);
+}
+
+/* per-tick bookkeeping for every thread except the one running */
+void scheduler_tick(void)
+{
     Thread *p;
-    for (p = Q->q[WAIT_TIME]; p != NULL; p = p->next)
-    {
-        p->timer -= IT_INTERVAL_MSEC;
-        //printf("%s has %d ms left\n", p->name, p->timer);
-    }
 
-    int tid;
-    while ((tid = next_wait_timeout_thread(Q)) >= 0)
+    tick_count++;
+    age_threads(Q, IT_INTERVAL_MSEC);
+    trace_event(TRACE_TICK, NULL, 0);
+
+    /* handle wait timeout threads */
+    while ((p = wake_expired_thread(Q)))
+        trace_event(TRACE_TIMER, p, 0);
+}
+
+/* everything a tick does besides preempting, shared by timeout_handler
+ * and a tick the dispatcher takes over from a thread that blocked */
+void account_tick(void)
+{
+    scheduler_tick();
+
+    if (Running)
+        Running->cold->cpu_time += IT_INTERVAL_MSEC;
+
+    if (stop_requested || (run_msec > 0 && tick_count * IT_INTERVAL_MSEC >= run_msec))
+        finish_simulation();
+
+    if (snapshot_ticks > 0 && tick_count % snapshot_ticks == 0)
+        snapshot_publish(Q, Running, tick_count, switch_count);
+
+    if (status_requested)
     {
-        p = dequeue_wait_time(Q, tid);
-        p->timer = 0;
-        p->event_id = 0;
-        p->state = READY;
-        enqueue(Q, p, p->state, 0);
+        status_requested = false;
+        print_thread_status();
+        stack_report(Q);
     }
+}
+
+void timeout_handler(void)
+{
+    account_tick();
 
     /* handle running thread */
     int time_quantum = get_time_quantum(Running->c_priority);
@@ -285,17 +742,24 @@ void timeout_handler(void)
     {
         Running->state = READY;
         Running->event_id = 0;
-        // lower priority
-        if (Running->c_priority != LOW)
+        // lower priority, but not below what a held mutex's waiters lent it
+        Prior floor = inherited_priority_floor(Running);
+        if (Running->c_priority < floor)
         {
             printf("The priority of %s changed from %d to %d\n",
-                   Running->name, Running->c_priority, Running->c_priority + 1);
+                   Running->cold->name, Running->c_priority, Running->c_priority + 1);
             fflush(stdout);
             Running->c_priority++;
         }
         Running->elapsed = 0;
-        // queue to lower priority
-        enqueue(Q, Running, READY, 0);
+
+        if (spin_quanta > 0 && spin_detected(Running))
+            park_spinning_thread(Running);
+        else
+        {
+            enqueue(Q, Running, READY, 0); // queue to lower priority
+            trace_event(TRACE_PREEMPT, Running, 0);
+        }
         setcontext(&dispatch_ctx);
     }
     else
@@ -303,20 +767,89 @@ void timeout_handler(void)
         Running->elapsed += IT_INTERVAL_MSEC;
         //printf("has run for %d ms\n", Running->elapsed);
         //fflush(stdout);
-        setcontext(&Running->ctx);
+        setcontext(&Running->cold->ctx);
     }
 }
 
+/* called once per expired quantum */
+bool spin_detected(Thread *T)
+{
+    if (T->api_active)
+        T->idle_quanta = 0;
+    else
+        T->idle_quanta++;
+    T->api_active = false;
+
+    return T->idle_quanta >= spin_quanta;
+}
+
+void park_spinning_thread(Thread *T)
+{
+    T->idle_quanta = 0;
+
+    if (spin_park_msec <= 0)
+    {
+        Prior floor = inherited_priority_floor(T);
+        if (T->c_priority < floor)
+        {
+            printf("The priority of %s changed from %d to %d\n",
+                   T->cold->name, T->c_priority, floor);
+            fflush(stdout);
+            T->c_priority = floor;
+        }
+        enqueue(Q, T, READY, 0);
+        trace_event(TRACE_PREEMPT, T, 0);
+        return;
+    }
+
+    printf("%s is spinning, parked for %d ms\n", T->cold->name, spin_park_msec);
+    fflush(stdout);
+    T->timer = spin_park_msec;
+    T->event_id = 8;
+    T->state = WAITING;
+    enqueue(Q, T, WAITING, 8);
+    trace_event(TRACE_PARK, T, T->timer);
+}
+
 void signal_handler(int signal)
 {
     if (signal == SIGALRM)
     {
-        swapcontext(&Running->ctx, &timeout_ctx);
+        if (!Running || Running->preempt_off > 0)
+        {
+            preempt_pending = true;
+            return;
+        }
+        swapcontext(&Running->cold->ctx, &timeout_ctx);
     }
 
     if (signal == SIGTSTP)
     {
-        print_thread_status();
+        // the queues may be mid-update here, let the next tick print them
+        status_requested = true;
+    }
+
+    if (signal == SIGINT)
+    {
+        // end on a tick so the trace is flushed at a consistent point
+        stop_requested = true;
+    }
+}
+
+/* the outermost critical section ended after a tick was deferred. The
+ * context saved here is resumed with setcontext, which unmasks SIGALRM
+ * before it switches stacks, so it is saved inside a critical section
+ * and leaves it only once the thread runs again (see thread_start) */
+void take_pending_preemption(void)
+{
+    while (preempt_pending)
+    {
+        preempt_pending = false;
+        Running->preempt_off++;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        swapcontext(&Running->cold->ctx, &timeout_ctx);
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        Running->preempt_off--;
     }
 }
 
@@ -326,15 +859,32 @@ void StartSchedulingSimulation()
     sigaction(SIGTSTP, &sa, NULL);
     sigaction(SIGALRM, &sa, NULL);
 
+    if (trace_file)
+    {
+        tracing = trace_open(trace_file) == 0;
+        if (tracing)
+            sigaction(SIGINT, &sa, NULL);
+    }
+
     queue_init_threads();
 
+    if (snapshot_ticks > 0 && snapshot_open(MAX_THREAD_NUM) < 0)
+    {
+        printf("Scheduler snapshots disabled\n");
+        fflush(stdout);
+        snapshot_ticks = 0;
+    }
+
     /*Set Timer*/
     Signaltimer.it_interval.tv_usec = IT_INTERVAL_MSEC * USEC_TO_MSEC;
     Signaltimer.it_interval.tv_sec = 0;
 
     /*Create Context*/
-    CreateContext(&dispatch_ctx, NULL, &Dispatcher);
-    CreateContext(&timeout_ctx, NULL, &timeout_handler);
+    CreateContext(&dispatch_ctx, NULL, &Dispatcher, STACK_SIZE);
+    CreateContext(&timeout_ctx, NULL, &timeout_handler, STACK_SIZE);
+    /* a tick landing in the scheduler would save its state into Running->cold->ctx */
+    sigaddset(&dispatch_ctx.uc_sigmask, SIGALRM);
+    sigaddset(&timeout_ctx.uc_sigmask, SIGALRM);
 
     ResetTimer();
     setcontext(&dispatch_ctx);
@@ -344,8 +894,6 @@ void queue_init_threads(void)
 {
     Q = create_queue();
 
-    FILE *fp;
-    char json_buffer[JSON_BUF_SIZE];
     struct json_object *parsed_json;
     struct json_object *threads;
     struct json_object *thread;
@@ -353,14 +901,16 @@ void queue_init_threads(void)
     struct json_object *entry_func;
     struct json_object *priority;
     struct json_object *cancel_mode;
+    struct json_object *template;
+    struct json_object *count;
     size_t n_threads;
 
-    fp = fopen("init_threads.json", "r");
-    FAIL_IF(!fp, "Failed to open file.");
-    fread(json_buffer, sizeof(char), JSON_BUF_SIZE, fp);
-    fclose(fp);
+    parsed_json = json_object_from_file(config_file);
+    FAIL_IF(!parsed_json, "Failed to open file.");
 
-    parsed_json = json_tokener_parse(json_buffer);
+    workload_load(parsed_json);
+    if (run_msec == 0)
+        run_msec = workload_duration();
 
     json_object_object_get_ex(parsed_json, "Threads", &threads);
     n_threads = json_object_array_length(threads);
@@ -370,6 +920,20 @@ void queue_init_threads(void)
         thread = json_object_array_get_idx(threads, i);
 
         json_object_object_get_ex(thread, "name", &name);
+
+        if (json_object_object_get_ex(thread, "template", &template))
+        {
+            workload_create_threads(json_object_get_string(template),
+                                    json_object_get_string(name),
+                                    json_object_object_get_ex(thread, "priority", &priority)
+                                        ? json_object_get_string(priority)
+                                        : NULL,
+                                    json_object_object_get_ex(thread, "count", &count)
+                                        ? json_object_get_int(count)
+                                        : 1);
+            continue;
+        }
+
         json_object_object_get_ex(thread, "entry function", &entry_func);
         json_object_object_get_ex(thread, "priority", &priority);
         json_object_object_get_ex(thread, "cancel mode", &cancel_mode);
@@ -380,6 +944,7 @@ void queue_init_threads(void)
                             json_object_get_int(cancel_mode));
     }
     OS2021_ThreadCreate("reclaimer", "ResourceReclaim", "L", 1);
+    json_object_put(parsed_json);
 }
 
 bool p_function_is_valid(const char *p_function)
@@ -389,7 +954,8 @@ bool p_function_is_valid(const char *p_function)
             strncmp(p_function, "Function3", MAX_STR_LEN) == 0 ||
             strncmp(p_function, "Function4", MAX_STR_LEN) == 0 ||
             strncmp(p_function, "Function5", MAX_STR_LEN) == 0 ||
-            strncmp(p_function, "ResourceReclaim", MAX_STR_LEN) == 0)
+            strncmp(p_function, "ResourceReclaim", MAX_STR_LEN) == 0 ||
+            strncmp(p_function, "Script", MAX_STR_LEN) == 0)
     {
         return true;
     }
@@ -445,7 +1011,7 @@ void print_thread_status(void)
                "%-10d"
                "\n",
                thread_list[i]->tid,
-               thread_list[i]->name,
+               thread_list[i]->cold->name,
                state_itos(thread_list[i]->state),
                priority_itos(thread_list[i]->b_priority),
                priority_itos(thread_list[i]->c_priority),
@@ -4,6 +4,28 @@
 #define _XOPEN_SOURCE 600
 #define STACK_SIZE 40960
 
+/* API entry points run as critical sections: a SIGALRM landing inside one
+ * is deferred until the outermost section exits. Entering also marks the
+ * thread active for spin detection. The signal fences keep the compiler
+ * from moving the section's loads and stores across the counter updates
+ * the signal handler looks at. */
+#define API_ENTER()                                       \
+    {                                                     \
+        if (Running)                                      \
+        {                                                 \
+            Running->api_active = true;                   \
+            Running->preempt_off++;                       \
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);      \
+        }                                                 \
+    }
+
+#define API_EXIT()                                                      \
+    {                                                                   \
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);                        \
+        if (Running && --Running->preempt_off == 0 && preempt_pending) \
+            take_pending_preemption();                                  \
+    }
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <ucontext.h>
@@ -14,20 +36,82 @@
 #include <string.h>
 #include "function_libary.h"
 #include "feedback_queue.h"
+#include "os2021_sync.h"
+#include "os2021_chan.h"
+#include "os2021_tls.h"
+#include "sched_snapshot.h"
+#include "stack_profile.h"
+#include "sched_trace.h"
+
+/* what every thread of an OS2021_ThreadCreateMany batch is made from */
+typedef struct os2021_thread_template_t
+{
+    char *p_function;
+    char *priority;
+    int cancel_mode;
+} OS2021_ThreadTemplate;
+
+/* one allocation per batch: the context each thread is cloned from on its
+ * first dispatch, followed by the stacks; freed with the last thread */
+typedef struct spawn_block_t
+{
+    ucontext_t ctx;
+    int refs;
+    char *stacks;    // lowest stack, the next one starts stride bytes higher
+    size_t stride;
+    size_t map_size; // length of the mapping, 0 if the block was malloc'd
+} SpawnBlock;
+
+#define SPAWN_HEADER_SIZE ((sizeof(SpawnBlock) + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1))
+
+extern Queue *Q;
+extern Thread *Running;
+extern volatile sig_atomic_t preempt_pending;
 
 int OS2021_ThreadCreate(char *job_name, char *p_function, char *priority, int cancel_mode);
+int OS2021_ThreadCreateMany(const OS2021_ThreadTemplate *tpl, int count, const char *name_prefix);
+void OS2021_ThreadExit(void);
 void OS2021_ThreadCancel(char *job_name);
 void OS2021_ThreadWaitEvent(int event_id);
 void OS2021_ThreadSetEvent(int event_id);
 void OS2021_ThreadWaitTime(int msec);
+void OS2021_ThreadYield(void);
 void OS2021_DeallocateThreadResource();
 void OS2021_TestCancel();
+void OS2021_SetConfigFile(const char *path);
+void OS2021_SetDuration(int msec);
+void OS2021_SetSpinDetector(int n_quanta, int park_msec);
+void OS2021_EnableSnapshot(int every_n_ticks);
+void OS2021_EnableStackProfile(bool autosize, int margin_percent);
+void OS2021_EnableTrace(const char *path);
 
-void CreateContext(ucontext_t *, ucontext_t *, void *);
+Thread *create_thread(char *job_name, char *p_function, char *priority, int cancel_mode);
+void format_index(char *buf, int n);
+void thread_start(void);
+void start_spawned_context(Thread *T);
+void *alloc_stack(size_t size);
+SpawnBlock *alloc_spawn_block(size_t stack_size, int count);
+void free_spawn_block(SpawnBlock *block);
+void free_stack(ThreadCold *cold);
+void trace_event(TraceOp op, Thread *T, int arg);
+void finish_simulation(void);
+void promote_if_quantum_unused(void);
+void prepare_block(void);
+void block_on_wait_queue(WaitQueue *W);
+void switch_to_dispatcher(void);
+void wake_thread(Thread *T);
+void handoff_to_thread(Thread *T);
+void set_thread_priority(Thread *T, Prior priority);
+void CreateContext(ucontext_t *, ucontext_t *, void *, size_t stack_size);
 void ResetTimer();
 void Dispatcher();
+void scheduler_tick(void);
+void account_tick(void);
 void timeout_handler(void);
+bool spin_detected(Thread *T);
+void park_spinning_thread(Thread *T);
 void signal_handler(int signal);
+void take_pending_preemption(void);
 void StartSchedulingSimulation();
 void queue_init_threads(void);
 void (*get_function_handle(const char *p_function))(void);
@@ -0,0 +1,52 @@
+#include "os2021_thread_api.h"
+
+static int n_keys = 0;
+static void (*destructors[OS2021_TLS_KEYS])(void *);
+
+int OS2021_TLSKeyCreate(OS2021_TLSKey *key, void (*destructor)(void *))
+{
+    API_ENTER();
+
+    if (n_keys == OS2021_TLS_KEYS)
+    {
+        API_EXIT();
+        return -1;
+    }
+    destructors[n_keys] = destructor;
+    *key = n_keys++;
+
+    API_EXIT();
+    return 0;
+}
+
+/* no critical section: only the running thread touches its own slots */
+void *OS2021_TLSGet(OS2021_TLSKey key)
+{
+    if ((unsigned)key >= n_keys)
+        return NULL;
+    return Running->cold->tls[key];
+}
+
+int OS2021_TLSSet(OS2021_TLSKey key, void *value)
+{
+    if ((unsigned)key >= n_keys)
+        return -1;
+    Running->cold->tls[key] = value;
+    return 0;
+}
+
+/* called by the reclaimer, so T is never Running here */
+void tls_run_destructors(Thread *T)
+{
+    void *value;
+
+    for (int key = 0; key < n_keys; ++key)
+    {
+        if ((value = T->cold->tls[key]))
+        {
+            T->cold->tls[key] = NULL;
+            if (destructors[key])
+                destructors[key](value);
+        }
+    }
+}
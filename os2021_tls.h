@@ -0,0 +1,18 @@
+#ifndef OS2021_TLS_H
+#define OS2021_TLS_H
+
+#include "feedback_queue.h"
+
+#define OS2021_TLS_KEYS N_TLS_SLOTS
+
+typedef int OS2021_TLSKey;
+
+/* keys are process wide and never deleted; each green thread has its own
+ * value per key, NULL until set and cleared again when its slot is reused */
+int OS2021_TLSKeyCreate(OS2021_TLSKey *key, void (*destructor)(void *));
+void *OS2021_TLSGet(OS2021_TLSKey key);
+int OS2021_TLSSet(OS2021_TLSKey key, void *value);
+
+void tls_run_destructors(Thread *T);
+
+#endif
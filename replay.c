@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "feedback_queue.h"
+#include "sched_trace.h"
+
+#define TICK_MSEC 10 // IT_INTERVAL_MSEC of the recording simulator
+#define NSEC_PER_SEC 1000000000L
+
+static Queue *Q;
+static Thread *Running = NULL;
+static Thread **by_tid; // replayed TCB of every tid in the trace
+static int n_tids;
+static WaitQueue blocked; // stands in for every sync object wait queue
+static TraceRecord *records;
+static long n_records;
+static long op_count[N_TRACE_OPS];
+static long op_nsec[N_TRACE_OPS];
+static long mismatches = 0;
+static bool keep_going = false;
+
+static long now_nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void mismatch(long i, const char *what, long expected, long got)
+{
+    TraceRecord *r = &records[i];
+
+    fprintf(stderr, "record %ld (tick %u, %s tid %d): %s %ld, expected %ld\n",
+            i, r->tick, trace_op_names[r->op], r->tid, what, got, expected);
+    mismatches++;
+    if (!keep_going)
+        exit(EXIT_FAILURE);
+}
+
+static Thread *lookup(long i, int tid)
+{
+    if (tid < 0 || !by_tid[tid])
+    {
+        mismatch(i, "unknown tid", tid, -1);
+        exit(EXIT_FAILURE); // nothing sensible to replay against
+    }
+    return by_tid[tid];
+}
+
+static Thread *create(int tid, Prior priority)
+{
+    Thread *T = init_thread(Q, tid, "replay", "replay", priority, 0);
+
+    if (!T)
+    {
+        fprintf(stderr, "Thread table full at tid %d\n", tid);
+        exit(EXIT_FAILURE);
+    }
+    by_tid[tid] = T;
+    return T;
+}
+
+/* Running leaves the CPU for queue Q_type/event_id */
+static void put_running(TraceRecord *r, State state, int event_id)
+{
+    Thread *T = Running;
+
+    Running = NULL;
+    T->c_priority = r->prio;
+    T->state = state;
+    T->event_id = event_id;
+    enqueue(Q, T, state, event_id);
+}
+
+/* apply one record the way os2021_thread_api.c did, checking the choices
+ * the queue code makes against the recorded ones */
+static void apply(long i)
+{
+    TraceRecord *r = &records[i];
+    Thread *T, *first, *last;
+    int tid;
+
+    switch (r->op)
+    {
+    case TRACE_CREATE:
+        enqueue(Q, create(r->tid, r->prio), READY, 0);
+        break;
+
+    case TRACE_CREATE_BATCH:
+        first = last = create(r->tid, r->prio);
+        for (tid = r->tid + 1; tid < r->tid + r->arg; ++tid)
+        {
+            T = create(tid, r->prio);
+            last->next = T;
+            last = T;
+        }
+        enqueue_batch(Q, first, last, READY, 0);
+        break;
+
+    case TRACE_DISPATCH:
+        for (int priority = 0; priority < N_PRIOR_LVL; ++priority)
+        {
+            if ((T = dequeue(Q, READY, priority, 0)))
+                break;
+        }
+        if (!T || T->tid != r->tid)
+            mismatch(i, "dispatched tid", r->tid, T ? T->tid : -1);
+        Running = T;
+        if (T)
+            T->state = RUNNING;
+        break;
+
+    case TRACE_HANDOFF:
+        T = lookup(i, r->tid);
+        wait_remove(&blocked, T);
+        Running->state = READY;
+        enqueue_head(Q, Running, READY, 0);
+        T->state = RUNNING;
+        T->event_id = 0;
+        Running = T;
+        break;
+
+    case TRACE_YIELD:
+    case TRACE_PREEMPT:
+        put_running(r, READY, 0);
+        break;
+
+    case TRACE_PARK:
+    case TRACE_WAIT_TIME:
+        Running->timer = r->arg;
+        put_running(r, WAITING, 8);
+        break;
+
+    case TRACE_WAIT_EVENT:
+        put_running(r, WAITING, r->arg);
+        break;
+
+    case TRACE_SET_EVENT:
+        T = dequeue_set_event(Q, r->arg);
+        if ((T ? T->tid : -1) != r->tid)
+            mismatch(i, "woken tid", r->tid, T ? T->tid : -1);
+        if (T)
+        {
+            T->state = READY;
+            T->event_id = 0;
+            enqueue(Q, T, READY, 0);
+        }
+        break;
+
+    case TRACE_TICK:
+        age_threads(Q, TICK_MSEC);
+        break;
+
+    case TRACE_TIMER:
+        T = wake_expired_thread(Q);
+        if ((T ? T->tid : -1) != r->tid)
+            mismatch(i, "expired tid", r->tid, T ? T->tid : -1);
+        break;
+
+    case TRACE_BLOCK:
+        T = Running;
+        Running = NULL;
+        T->c_priority = r->prio;
+        T->state = WAITING;
+        wait_enqueue(&blocked, T);
+        break;
+
+    case TRACE_WAKE:
+        T = lookup(i, r->tid);
+        wait_remove(&blocked, T);
+        T->state = READY;
+        T->event_id = 0;
+        enqueue(Q, T, READY, 0);
+        break;
+
+    case TRACE_PRIORITY:
+        change_priority(Q, lookup(i, r->tid), r->prio);
+        break;
+
+    case TRACE_EXIT:
+        T = Running;
+        Running = NULL;
+        T->state = TERMINATED;
+        enqueue(Q, T, TERMINATED, 0);
+        break;
+
+    case TRACE_CANCEL:
+        T = lookup(i, r->tid);
+        if (T == Running)
+            Running = NULL;
+        else
+            unlink_thread(Q, T);
+        T->state = TERMINATED;
+        enqueue(Q, T, TERMINATED, 0);
+        break;
+
+    case TRACE_RECLAIM:
+        T = dequeue(Q, TERMINATED, 0, 0);
+        if (!T || T->tid != r->tid)
+            mismatch(i, "reclaimed tid", r->tid, T ? T->tid : -1);
+        if (T)
+        {
+            by_tid[T->tid] = NULL;
+            free_thread(Q, T);
+        }
+        break;
+
+    default:
+        fprintf(stderr, "record %ld has unknown op %d\n", i, r->op);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static int max_tid(void)
+{
+    int max = 0, last;
+
+    for (long i = 0; i < n_records; ++i)
+    {
+        last = records[i].op == TRACE_CREATE_BATCH ? records[i].tid + records[i].arg - 1 : records[i].tid;
+        if (last > max)
+            max = last;
+    }
+    return max;
+}
+
+typedef enum
+{
+    PASS_TIMED,  // nothing but the queue calls, timed as a whole
+    PASS_VERIFY, // compare the queue digest after every record
+    PASS_PER_OP  // verify and time each record on its own
+} Pass;
+
+/* one pass over the trace on a fresh queue, returns its time in ns */
+static long replay_once(Pass pass)
+{
+    long t0, start;
+    unsigned int digest;
+
+    memset(by_tid, 0, n_tids * sizeof(Thread *));
+    Q = create_queue();
+    Running = NULL;
+    register_wait_queue(Q, &blocked, WAIT_FIFO);
+
+    start = now_nsec();
+    if (pass == PASS_TIMED)
+    {
+        for (long i = 0; i < n_records; ++i)
+            apply(i);
+    }
+    else
+    {
+        for (long i = 0; i < n_records; ++i)
+        {
+            if (pass == PASS_PER_OP)
+            {
+                t0 = now_nsec();
+                apply(i);
+                op_nsec[records[i].op] += now_nsec() - t0;
+            }
+            else
+            {
+                apply(i);
+            }
+            op_count[records[i].op]++;
+
+            if ((digest = queue_digest(Q)) != records[i].digest)
+                mismatch(i, "queue digest", records[i].digest, digest);
+        }
+    }
+    start = now_nsec() - start;
+
+    free_queue(Q);
+    return start;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-l loops] [-k] [-p] trace\n"
+                    "  -l loops  time this many passes and report the fastest (default 1)\n"
+                    "  -k        keep going after a mismatch\n"
+                    "  -p        also time every record and print ns/op per type\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    int opt, loops = 1;
+    bool per_op = false;
+    long best = -1, elapsed;
+
+    while ((opt = getopt(argc, argv, "l:kp")) != -1)
+    {
+        switch (opt)
+        {
+        case 'l':
+            loops = atoi(optarg);
+            break;
+        case 'k':
+            keep_going = true;
+            break;
+        case 'p':
+            per_op = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || loops < 1)
+        usage(argv[0]);
+
+    if (!(records = trace_load(argv[optind], &n_records)))
+        return EXIT_FAILURE;
+    n_tids = max_tid() + 1;
+    by_tid = calloc(n_tids, sizeof(Thread *));
+
+    // check every digest first, then time passes that do nothing else
+    replay_once(per_op ? PASS_PER_OP : PASS_VERIFY);
+    for (int l = 0; l < loops; ++l)
+    {
+        elapsed = replay_once(PASS_TIMED);
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    printf("%ld records over %u ticks, %ld mismatches\n", n_records,
+           n_records ? records[n_records - 1].tick : 0, mismatches);
+    printf("%-14s%12s%s\n", "operation", "count", per_op ? "       ns/op" : "");
+    for (int op = 0; op < N_TRACE_OPS; ++op)
+    {
+        if (!op_count[op])
+            continue;
+        printf("%-14s%12ld", trace_op_names[op], op_count[op]);
+        if (per_op)
+            printf("%12.1f", (double)op_nsec[op] / op_count[op]);
+        printf("\n");
+    }
+    printf("fastest of %d: %.3f ms, %.0f ops/s\n", loops, best / 1e6,
+           best > 0 ? n_records / ((double)best / NSEC_PER_SEC) : 0.0);
+    return mismatches ? EXIT_FAILURE : 0;
+}
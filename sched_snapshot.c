@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "sched_snapshot.h"
+
+static Snapshot *S = NULL;
+
+static void copy_thread(SnapshotThread *e, Thread *T)
+{
+    e->tid = T->tid;
+    e->state = T->state;
+    e->b_priority = T->b_priority;
+    e->c_priority = T->c_priority;
+    e->queue_time = T->queue_time;
+    e->wait_time = T->wait_time;
+    e->elapsed = T->elapsed;
+    strncpy(e->name, T->cold->name, SNAPSHOT_NAME_LEN - 1);
+    e->name[SNAPSHOT_NAME_LEN - 1] = '\0';
+}
+
+int snapshot_open(int capacity)
+{
+    size_t size = sizeof(Snapshot) + sizeof(SnapshotThread) * capacity;
+    int fd;
+
+    if ((fd = shm_open(SNAPSHOT_SHM_NAME, O_CREAT | O_RDWR | O_TRUNC, 0644)) < 0)
+    {
+        perror("shm_open");
+        return -1;
+    }
+    if (ftruncate(fd, size) < 0)
+    {
+        perror("ftruncate");
+        close(fd);
+        return -1;
+    }
+    S = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (S == MAP_FAILED)
+    {
+        perror("mmap");
+        S = NULL;
+        return -1;
+    }
+
+    S->seq = 0;
+    S->pid = getpid();
+    S->capacity = capacity;
+    S->n_threads = 0;
+    __atomic_store_n(&S->magic, SNAPSHOT_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* seqlock writer: readers retry if seq was odd or moved while they copied */
+void snapshot_publish(Queue *Q, Thread *Running, long tick, long switches)
+{
+    Thread *p;
+    unsigned int seq;
+    int n = 0;
+
+    if (!S)
+        return;
+
+    seq = S->seq;
+    __atomic_store_n(&S->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (Running)
+        copy_thread(&S->threads[n++], Running);
+    for (p = Q->threads; p < Q->threads + Q->n_slots && n < S->capacity; ++p)
+    {
+        if (p != Running && p->state != UNUSED)
+            copy_thread(&S->threads[n++], p);
+    }
+    S->n_threads = n;
+    S->tick = tick;
+    S->switches = switches;
+
+    __atomic_store_n(&S->seq, seq + 2, __ATOMIC_RELEASE);
+}
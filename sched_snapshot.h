@@ -0,0 +1,38 @@
+#ifndef SCHED_SNAPSHOT_H
+#define SCHED_SNAPSHOT_H
+
+#define SNAPSHOT_SHM_NAME "/os2021_sched"
+#define SNAPSHOT_MAGIC 0x4f533231 // "OS21"
+#define SNAPSHOT_NAME_LEN 32
+
+#include "feedback_queue.h"
+
+typedef struct snapshot_thread_t
+{
+    int tid;
+    int state;
+    int b_priority;
+    int c_priority;
+    int queue_time;
+    int wait_time;
+    int elapsed;
+    char name[SNAPSHOT_NAME_LEN];
+} SnapshotThread;
+
+/* shared memory layout; seq is odd while the simulator is rewriting it */
+typedef struct snapshot_t
+{
+    unsigned int magic;
+    unsigned int seq;
+    int pid;
+    int capacity; // entries in threads[]
+    long tick;
+    long switches; // dispatches plus direct handoffs
+    int n_threads;
+    SnapshotThread threads[];
+} Snapshot;
+
+int snapshot_open(int capacity);
+void snapshot_publish(Queue *Q, Thread *Running, long tick, long switches);
+
+#endif
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "sched_trace.h"
+
+const char *trace_op_names[N_TRACE_OPS] = {
+    "create", "create_batch", "dispatch", "handoff", "yield", "preempt", "park",
+    "wait_event", "wait_time", "set_event", "tick", "timer", "block", "wake",
+    "priority", "exit", "cancel", "reclaim"};
+
+static int trace_fd = -1;
+static TraceRecord buf[TRACE_BUF_RECORDS];
+static int n_buf = 0;
+
+/* records are written from the scheduler, so no stdio: a thread may have
+ * been preempted inside it */
+static void flush_buf(void)
+{
+    if (n_buf > 0 && write(trace_fd, buf, n_buf * sizeof(TraceRecord)) < 0)
+        perror("trace write");
+    n_buf = 0;
+}
+
+int trace_open(const char *path)
+{
+    TraceHeader header = {TRACE_MAGIC, TRACE_VERSION, sizeof(TraceRecord)};
+
+    if ((trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+        perror("trace open");
+        return -1;
+    }
+    if (write(trace_fd, &header, sizeof(header)) < 0)
+    {
+        perror("trace write");
+        close(trace_fd);
+        trace_fd = -1;
+        return -1;
+    }
+    atexit(trace_close);
+    return 0;
+}
+
+void trace_write(const TraceRecord *r)
+{
+    if (trace_fd < 0)
+        return;
+    buf[n_buf++] = *r;
+    if (n_buf == TRACE_BUF_RECORDS)
+        flush_buf();
+}
+
+void trace_close(void)
+{
+    if (trace_fd < 0)
+        return;
+    flush_buf();
+    close(trace_fd);
+    trace_fd = -1;
+}
+
+/* the whole trace in memory, NULL if the file is not a trace */
+TraceRecord *trace_load(const char *path, long *n_records)
+{
+    FILE *fp;
+    TraceHeader header;
+    TraceRecord *records;
+    long size;
+
+    if (!(fp = fopen(path, "rb")))
+    {
+        perror(path);
+        return NULL;
+    }
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != TRACE_MAGIC ||
+        header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord))
+    {
+        fprintf(stderr, "%s is not a version %d trace\n", path, TRACE_VERSION);
+        fclose(fp);
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp) - sizeof(header);
+    fseek(fp, sizeof(header), SEEK_SET);
+
+    *n_records = size / sizeof(TraceRecord);
+    if (!(records = malloc(*n_records * sizeof(TraceRecord) + 1)) ||
+        fread(records, sizeof(TraceRecord), *n_records, fp) != *n_records)
+    {
+        fprintf(stderr, "Failed to read %s\n", path);
+        free(records);
+        records = NULL;
+    }
+    fclose(fp);
+    return records;
+}
@@ -0,0 +1,57 @@
+#ifndef SCHED_TRACE_H
+#define SCHED_TRACE_H
+
+#define TRACE_MAGIC 0x5254534f // "OSTR"
+#define TRACE_VERSION 1
+#define TRACE_BUF_RECORDS 4096
+
+typedef enum
+{
+    TRACE_CREATE,       // tid, prio = base priority
+    TRACE_CREATE_BATCH, // first tid, arg = count, tids are consecutive
+    TRACE_DISPATCH,     // tid taken from ready level prio
+    TRACE_HANDOFF,      // tid runs directly, the old Running goes to the head of its level
+    TRACE_YIELD,
+    TRACE_PREEMPT,      // quantum expired, prio after demotion
+    TRACE_PARK,         // spin detector parked tid, arg = timer ms
+    TRACE_WAIT_EVENT,   // arg = event id, prio after promotion
+    TRACE_WAIT_TIME,    // arg = timer ms, prio after promotion
+    TRACE_SET_EVENT,    // arg = event id, tid woken or -1
+    TRACE_TICK,         // wait timers have been counted down
+    TRACE_TIMER,        // tid's wait time expired
+    TRACE_BLOCK,        // Running blocks on a sync object, prio after promotion
+    TRACE_WAKE,         // tid leaves a sync object for the ready queue
+    TRACE_PRIORITY,     // tid's c_priority set to prio
+    TRACE_EXIT,         // Running terminated itself
+    TRACE_CANCEL,       // tid cancelled and moved to the terminated queue
+    TRACE_RECLAIM,      // tid taken off the terminated queue and freed
+    N_TRACE_OPS
+} TraceOp;
+
+typedef struct trace_header_t
+{
+    unsigned int magic;
+    unsigned short version;
+    unsigned short record_size;
+} TraceHeader;
+
+/* one scheduling decision; digest is queue_digest() right after it */
+typedef struct trace_record_t
+{
+    unsigned int tick;
+    int tid;
+    int arg;
+    unsigned int digest;
+    unsigned char op;
+    unsigned char prio;
+    unsigned short reserved;
+} TraceRecord;
+
+extern const char *trace_op_names[N_TRACE_OPS];
+
+int trace_open(const char *path);
+void trace_write(const TraceRecord *r);
+void trace_close(void);
+TraceRecord *trace_load(const char *path, long *n_records);
+
+#endif
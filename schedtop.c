@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sched_snapshot.h"
+
+#define FAIL_IF(EXP, MSG)              \
+    {                                  \
+        if (EXP)                       \
+        {                              \
+            fprintf(stderr, MSG "\n"); \
+            exit(EXIT_FAILURE);        \
+        }                              \
+    }
+
+static const char *state_name(int state)
+{
+    switch (state)
+    {
+    case RUNNING:
+        return "Running";
+    case READY:
+        return "Ready";
+    case WAITING:
+        return "Waiting";
+    case TERMINATED:
+        return "Terminated";
+    default:
+        return "?";
+    }
+}
+
+static char priority_name(int prior)
+{
+    return prior == HIGH ? 'H' : prior == MEDIUM ? 'M' : 'L';
+}
+
+/* copy a consistent snapshot out of shm; returns 0 on success */
+static int read_snapshot(const Snapshot *S, Snapshot *out)
+{
+    unsigned int seq1, seq2;
+
+    for (int tries = 0; tries < 1000; ++tries)
+    {
+        seq1 = __atomic_load_n(&S->seq, __ATOMIC_ACQUIRE);
+        if (seq1 & 1)
+            continue;
+
+        memcpy(out, S, sizeof(Snapshot));
+        if (out->n_threads > S->capacity)
+            continue;
+        memcpy(out->threads, S->threads, sizeof(SnapshotThread) * out->n_threads);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq2 = __atomic_load_n(&S->seq, __ATOMIC_RELAXED);
+        if (seq1 == seq2)
+            return 0;
+    }
+    return -1;
+}
+
+static void print_snapshot(const Snapshot *snap, long prev_switches, double interval)
+{
+    int n_ready = 0, n_waiting = 0;
+
+    for (int i = 0; i < snap->n_threads; ++i)
+    {
+        if (snap->threads[i].state == READY)
+            n_ready++;
+        else if (snap->threads[i].state == WAITING)
+            n_waiting++;
+    }
+
+    printf("pid %d  tick %ld  threads %d (ready %d, waiting %d)  switches/s %.0f%s\n",
+           snap->pid, snap->tick, snap->n_threads, n_ready, n_waiting,
+           prev_switches < 0 ? 0.0 : (snap->switches - prev_switches) / interval,
+           kill(snap->pid, 0) < 0 ? "  [exited]" : "");
+    printf("%-10s%-14s%-12s%-12s%-12s%-10s%-10s%-10s\n",
+           "TID", "Name", "State", "B_Priority", "C_Priority", "Q_Time", "W_Time", "Elapsed");
+    for (int i = 0; i < snap->n_threads; ++i)
+    {
+        const SnapshotThread *t = &snap->threads[i];
+        printf("%-10d%-14s%-12s%-12c%-12c%-10d%-10d%-10d\n",
+               t->tid, t->name, state_name(t->state),
+               priority_name(t->b_priority), priority_name(t->c_priority),
+               t->queue_time, t->wait_time, t->elapsed);
+    }
+    fflush(stdout);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-i seconds] [-n count] [-b]\n"
+                    "  -i seconds  sampling interval, default 1\n"
+                    "  -n count    exit after count samples\n"
+                    "  -b          batch output, do not clear the screen\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    int opt, fd;
+    int count = -1;
+    bool batch = false;
+    double interval = 1.0;
+    struct stat st;
+    Snapshot *S, *snap;
+    long prev_switches = -1;
+
+    while ((opt = getopt(argc, argv, "i:n:b")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            interval = atof(optarg);
+            break;
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'b':
+            batch = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    FAIL_IF(interval <= 0, "Interval must be positive.");
+
+    fd = shm_open(SNAPSHOT_SHM_NAME, O_RDONLY, 0);
+    FAIL_IF(fd < 0, "No scheduler snapshot found, start the simulator with -m.");
+    FAIL_IF(fstat(fd, &st) < 0 || st.st_size < sizeof(Snapshot), "Snapshot segment is too small.");
+    S = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    FAIL_IF(S == MAP_FAILED, "Failed to map the snapshot segment.");
+    FAIL_IF(S->magic != SNAPSHOT_MAGIC, "Snapshot segment has an unknown format.");
+    FAIL_IF(sizeof(Snapshot) + sizeof(SnapshotThread) * S->capacity > st.st_size,
+            "Snapshot segment is truncated.");
+    FAIL_IF(!(snap = malloc(sizeof(Snapshot) + sizeof(SnapshotThread) * S->capacity)),
+            "Snapshot buffer malloc failure!");
+
+    while (count != 0)
+    {
+        if (read_snapshot(S, snap) == 0)
+        {
+            if (!batch)
+                printf("\033[H\033[2J");
+            print_snapshot(snap, prev_switches, interval);
+            prev_switches = snap->switches;
+        }
+        else
+        {
+            fprintf(stderr, "Snapshot kept changing, skipped a sample.\n");
+        }
+
+        if (count > 0)
+            count--;
+        if (count != 0)
+            usleep(interval * 1000000);
+    }
+    return 0;
+}
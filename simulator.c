@@ -1,7 +1,68 @@
 #include "os2021_thread_api.h"
 
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-c file] [-d msec] [-s quanta] [-k msec] [-m ticks] [-p] [-a percent] [-r file]\n"
+                    "  -c file    read threads and workload templates from file, default init_threads.json\n"
+                    "  -d msec    stop after msec and print the workload summary, overrides \"Duration\"\n"
+                    "  -s quanta  treat threads with no API call for this many quanta as spinning\n"
+                    "  -k msec    park spinning threads for msec instead of demoting them\n"
+                    "  -m ticks   publish a snapshot for schedtop every this many ticks\n"
+                    "  -p         measure stack high-water marks, shown with the status table\n"
+                    "  -a percent size new stacks per entry function from the measurements plus percent\n"
+                    "  -r file    record every scheduling decision to file for ./replay\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
 int main(int argc, char **argv)
 {
+    int opt;
+    int spin_quanta = 0;
+    int park_msec = 0;
+    int snapshot_ticks = 0;
+    int duration = 0;
+    bool profile_stacks = false;
+    int autosize_margin = -1;
+
+    while ((opt = getopt(argc, argv, "c:d:s:k:m:pa:r:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            OS2021_SetConfigFile(optarg);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 's':
+            spin_quanta = atoi(optarg);
+            break;
+        case 'k':
+            park_msec = atoi(optarg);
+            break;
+        case 'm':
+            snapshot_ticks = atoi(optarg);
+            break;
+        case 'p':
+            profile_stacks = true;
+            break;
+        case 'a':
+            autosize_margin = atoi(optarg);
+            break;
+        case 'r':
+            OS2021_EnableTrace(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    OS2021_SetDuration(duration);
+    OS2021_SetSpinDetector(spin_quanta, park_msec);
+    OS2021_EnableSnapshot(snapshot_ticks);
+    if (profile_stacks || autosize_margin >= 0)
+        OS2021_EnableStackProfile(autosize_margin >= 0, autosize_margin);
     StartSchedulingSimulation();
     return 0;
 }
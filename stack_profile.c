@@ -0,0 +1,139 @@
+#include "os2021_thread_api.h"
+#include "stack_profile.h"
+
+typedef struct
+{
+    char p_func[MAX_STR_LEN];
+    long samples;     // reclaimed threads measured
+    long overflows;   // samples whose lowest canary word was overwritten
+    size_t max_used;
+    size_t sum_used;
+} StackProfile;
+
+static StackProfile profiles[MAX_STACK_PROFILES];
+static int n_profiles = 0;
+static bool profiling = false;
+static bool autosize = false;
+static int margin = 0; // percent added to the deepest use seen
+
+void stack_profile_enable(bool autosize_stacks, int margin_percent)
+{
+    profiling = true;
+    autosize = autosize_stacks;
+    margin = margin_percent;
+}
+
+static StackProfile *find_profile(const char *p_func, bool create)
+{
+    for (int i = 0; i < n_profiles; ++i)
+    {
+        if (strncmp(profiles[i].p_func, p_func, MAX_STR_LEN) == 0)
+            return &profiles[i];
+    }
+    if (!create || n_profiles == MAX_STACK_PROFILES)
+        return NULL;
+    strncpy(profiles[n_profiles].p_func, p_func, MAX_STR_LEN - 1);
+    return &profiles[n_profiles++];
+}
+
+/* stacks grow down, so the untouched canary words are at the low end */
+static size_t stack_used(void *stack, size_t size)
+{
+    unsigned long *p = stack;
+    unsigned long *end = p + size / sizeof(unsigned long);
+
+    while (p < end && *p == STACK_CANARY)
+        ++p;
+    return (char *)stack + size - (char *)p;
+}
+
+static size_t suggested_size(StackProfile *prof)
+{
+    size_t size;
+
+    if (prof->overflows)
+        return STACK_SIZE;
+
+    size = prof->max_used + prof->max_used * margin / 100 + STACK_SIGNAL_RESERVE;
+    size = (size + 1023) & ~(size_t)1023;
+    if (size < STACK_MIN_SIZE)
+        size = STACK_MIN_SIZE;
+    if (size > STACK_SIZE)
+        size = STACK_SIZE;
+    return size;
+}
+
+size_t stack_size_for(const char *p_func)
+{
+    StackProfile *prof;
+
+    if (!autosize || !(prof = find_profile(p_func, false)) || prof->samples < STACK_AUTOSIZE_SAMPLES)
+        return STACK_SIZE;
+    return suggested_size(prof);
+}
+
+void stack_paint(void *stack, size_t size)
+{
+    unsigned long *p = stack;
+
+    if (!profiling)
+        return;
+    for (size_t i = 0; i < size / sizeof(unsigned long); ++i)
+        p[i] = STACK_CANARY;
+}
+
+void stack_record(const char *p_func, void *stack, size_t size)
+{
+    StackProfile *prof;
+    size_t used;
+
+    if (!profiling || !(prof = find_profile(p_func, true)))
+        return;
+
+    used = stack_used(stack, size);
+    prof->samples++;
+    prof->sum_used += used;
+    if (used > prof->max_used)
+        prof->max_used = used;
+    if (used == size)
+    {
+        prof->overflows++;
+        printf("A %s thread used all of its %zu byte stack\n", p_func, size);
+        fflush(stdout);
+    }
+}
+
+void stack_report(Queue *Q)
+{
+    StackProfile *prof;
+    Thread *T;
+    size_t live_max[MAX_STACK_PROFILES] = {0};
+    size_t used;
+
+    if (!profiling)
+        return;
+
+    /* threads still alive have not been sampled yet, peek at them too */
+    for (T = Q->threads; T < Q->threads + Q->n_slots; ++T)
+    {
+        if (T->state == UNUSED || !(prof = find_profile(T->cold->p_func, true)))
+            continue;
+        used = stack_used(T->cold->ctx.uc_stack.ss_sp, T->cold->ctx.uc_stack.ss_size);
+        if (used > live_max[prof - profiles])
+            live_max[prof - profiles] = used;
+    }
+
+    printf("\n---------------------------------------------------------------------------\n");
+    printf("%-18s%-10s%-10s%-10s%-10s%-10s%-10s\n",
+           "Function", "Reclaimed", "Max used", "Avg used", "Live max", "Overflow", "Next size");
+    for (int i = 0; i < n_profiles; ++i)
+    {
+        prof = &profiles[i];
+        printf("%-18s%-10ld%-10zu%-10zu%-10zu%-10ld%-10zu\n",
+               prof->p_func, prof->samples, prof->max_used,
+               prof->samples ? prof->sum_used / prof->samples : 0,
+               live_max[i], prof->overflows, stack_size_for(prof->p_func));
+    }
+    printf("---------------------------------------------------------------------------\n");
+    fflush(stdout);
+}
@@ -0,0 +1,20 @@
+#ifndef STACK_PROFILE_H
+#define STACK_PROFILE_H
+
+#define STACK_CANARY 0xdeadbeefcafebabeUL
+#define STACK_MIN_SIZE 8192        // never autosize below this
+#define STACK_SIGNAL_RESERVE 4096  // room for a SIGALRM frame the samples missed
+#define STACK_AUTOSIZE_SAMPLES 4   // reclaimed threads seen before resizing a p_func
+#define MAX_STACK_PROFILES 32
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "feedback_queue.h"
+
+void stack_profile_enable(bool autosize, int margin_percent);
+size_t stack_size_for(const char *p_func);
+void stack_paint(void *stack, size_t size);
+void stack_record(const char *p_func, void *stack, size_t size);
+void stack_report(Queue *Q);
+
+#endif
@@ -0,0 +1,467 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "feedback_queue.h"
+
+#define N_SYNC_Q 4
+#define DEFAULT_STEPS 1000000
+#define DEFAULT_THREADS 2000
+#define NSEC_PER_SEC 1000000000L
+
+#define CHECK(EXP, ...)                                                     \
+    {                                                                       \
+        if (!(EXP))                                                         \
+        {                                                                   \
+            fprintf(stderr, "Invariant broken at step %ld (seed %lu): ",    \
+                    step, seed);                                            \
+            fprintf(stderr, __VA_ARGS__);                                   \
+            fprintf(stderr, "\n");                                          \
+            exit(EXIT_FAILURE);                                             \
+        }                                                                   \
+    }
+
+typedef enum
+{
+    OP_CREATE,
+    OP_CREATE_BATCH,
+    OP_DISPATCH,
+    OP_PREEMPT,
+    OP_YIELD,
+    OP_WAIT_EVENT,
+    OP_WAIT_TIME,
+    OP_SET_EVENT,
+    OP_TICK,
+    OP_CANCEL,
+    OP_BLOCK_SYNC,
+    OP_WAKE_SYNC,
+    OP_REPRIORITIZE,
+    OP_RECLAIM,
+    N_OPS
+} Op;
+
+static const char *op_names[N_OPS] = {
+    "create", "create_batch", "dispatch", "preempt", "yield", "wait_event", "wait_time", "set_event",
+    "tick", "cancel", "block_sync", "wake_sync", "reprioritize", "reclaim"};
+static const int op_weights[N_OPS] = {10, 2, 15, 10, 5, 10, 8, 10, 8, 6, 6, 6, 4, 8};
+
+static Queue *Q = NULL;
+static Thread *Running = NULL;
+static WaitQueue sync_q[N_SYNC_Q];
+static unsigned long seed = 1;
+static unsigned long rng_state;
+static long step = 0;
+static int tid_counter = 0;
+static int target_threads = DEFAULT_THREADS;
+static long live = 0; // created and not yet reclaimed
+static long op_count[N_OPS];
+static long op_nsec[N_OPS];
+static bool time_ops = false; // per-op clock reads, which cost as much as the ops
+static int total_weight = 0;
+static unsigned char *seen; // per slot visit count while checking
+
+static unsigned long rng(void)
+{
+    // xorshift64*, so runs do not depend on the libc rand()
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717UL;
+}
+
+static int rng_below(int n)
+{
+    return rng() % n;
+}
+
+static long now_nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* a random thread that has not terminated, or NULL */
+static Thread *pick_live_thread(void)
+{
+    Thread *T;
+
+    if (Q->n_slots == 0)
+        return NULL;
+    for (int tries = 0; tries < 16; ++tries)
+    {
+        T = &Q->threads[rng_below(Q->n_slots)];
+        if (T->state != UNUSED && T->state != TERMINATED)
+            return T;
+    }
+    return NULL;
+}
+
+/* what OS2021_ThreadCancel does to a thread in cancel mode 0 */
+static void cancel_thread(Thread *T)
+{
+    if (T == Running)
+        Running = NULL;
+    else
+        unlink_thread(Q, T);
+    T->am_cancelled = true;
+    T->state = TERMINATED;
+    enqueue(Q, T, TERMINATED, 0);
+}
+
+static void make_ready(Thread *T)
+{
+    T->state = READY;
+    T->event_id = 0;
+    enqueue(Q, T, READY, 0);
+}
+
+static bool run_op(Op op)
+{
+    Thread *T;
+    int event_id;
+    WaitQueue *W;
+
+    switch (op)
+    {
+    case OP_CREATE:
+        if (live >= target_threads)
+            return false;
+        if (!(T = init_thread(Q, tid_counter, "stress", "Stress", rng_below(N_PRIOR_LVL), rng_below(2))))
+            return false;
+        tid_counter++;
+        live++;
+        enqueue(Q, T, READY, 0);
+        return true;
+
+    case OP_CREATE_BATCH:
+    {
+        // what OS2021_ThreadCreateMany does: link a run, splice it once
+        Thread *first = NULL, *last = NULL;
+        Prior priority = rng_below(N_PRIOR_LVL);
+        int n = 1 + rng_below(16);
+
+        for (int i = 0; i < n && live < target_threads; ++i)
+        {
+            if (!(T = init_thread(Q, tid_counter, "batch", "Stress", priority, 1)))
+                break;
+            tid_counter++;
+            live++;
+            if (last)
+                last->next = T;
+            else
+                first = T;
+            last = T;
+        }
+        if (!first)
+            return false;
+        enqueue_batch(Q, first, last, READY, 0);
+        return true;
+    }
+
+    case OP_DISPATCH:
+        if (Running)
+            return false;
+        for (int priority = 0; priority < N_PRIOR_LVL && !Running; ++priority)
+            Running = dequeue(Q, READY, priority, 0);
+        if (!Running)
+            return false;
+        Running->state = RUNNING;
+        return true;
+
+    case OP_PREEMPT:
+    case OP_YIELD:
+        if (!Running)
+            return false;
+        if (op == OP_PREEMPT && Running->c_priority != LOW)
+            Running->c_priority++;
+        make_ready(Running);
+        Running = NULL;
+        return true;
+
+    case OP_WAIT_EVENT:
+        if (!Running)
+            return false;
+        if (Running->c_priority != HIGH && rng_below(2))
+            Running->c_priority--;
+        Running->event_id = rng_below(N_EVENT_Q);
+        Running->state = WAITING;
+        enqueue(Q, Running, WAITING, Running->event_id);
+        Running = NULL;
+        return true;
+
+    case OP_WAIT_TIME:
+        if (!Running)
+            return false;
+        Running->timer = 10 * (1 + rng_below(20));
+        Running->event_id = 8;
+        Running->state = WAITING;
+        enqueue(Q, Running, WAITING, 8);
+        Running = NULL;
+        return true;
+
+    case OP_SET_EVENT:
+        event_id = rng_below(N_EVENT_Q);
+        if (!(T = dequeue_set_event(Q, event_id)))
+            return false;
+        CHECK(T->state == WAITING && T->event_id == event_id,
+              "set_event %d woke tid %d in state %d event %d", event_id, T->tid, T->state, T->event_id);
+        make_ready(T);
+        return true;
+
+    case OP_TICK:
+        age_threads(Q, 10);
+        while ((T = wake_expired_thread(Q)))
+            CHECK(T->state == READY && !T->timer, "expired tid %d was not made ready", T->tid);
+        return true;
+
+    case OP_CANCEL:
+        if (!(T = pick_live_thread()))
+            return false;
+        cancel_thread(T);
+        return true;
+
+    case OP_BLOCK_SYNC:
+        if (!Running)
+            return false;
+        Running->state = WAITING;
+        wait_enqueue(&sync_q[rng_below(N_SYNC_Q)], Running);
+        Running = NULL;
+        return true;
+
+    case OP_WAKE_SYNC:
+        W = &sync_q[rng_below(N_SYNC_Q)];
+        if (!(T = wait_dequeue(W)))
+            return false;
+        CHECK(!T->cold->blocked_on, "tid %d still points at its sync queue", T->tid);
+        make_ready(T);
+        return true;
+
+    case OP_REPRIORITIZE:
+        // what priority inheritance does to a queued thread
+        if (!(T = pick_live_thread()) || T == Running)
+            return false;
+        change_priority(Q, T, rng_below(N_PRIOR_LVL));
+        return true;
+
+    case OP_RECLAIM:
+        if (!(T = dequeue(Q, TERMINATED, 0, 0)))
+            return false;
+        CHECK(T->state == TERMINATED, "reclaimed tid %d in state %d", T->tid, T->state);
+        free_thread(Q, T);
+        live--;
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+static void visit(Thread *T, const char *where)
+{
+    int slot = T - Q->threads;
+
+    CHECK(slot >= 0 && slot < Q->n_slots, "%s holds a pointer outside the TCB table", where);
+    CHECK(T->state != UNUSED, "%s holds free slot %d", where, slot);
+    CHECK(++seen[slot] == 1, "tid %d is linked more than once (%s)", T->tid, where);
+}
+
+/* every thread sits in exactly one place and its fields agree with it */
+static void check_invariants(void)
+{
+    Thread *T, *last;
+    WaitQueue *W;
+    long found = 0, n_free = 0;
+    int expected_idx;
+
+    memset(seen, 0, Q->n_slots);
+
+    if (Running)
+    {
+        visit(Running, "Running");
+        CHECK(Running->state == RUNNING, "running tid %d has state %d", Running->tid, Running->state);
+        found++;
+    }
+
+    for (int i = 0; i < N_QUEUES; ++i)
+    {
+        last = NULL;
+        for (T = Q->q[i]; T != NULL; last = T, T = T->next)
+        {
+            visit(T, "queue");
+            expected_idx = get_queue_idx(T->state, T->c_priority, T->event_id);
+            CHECK(T->state != RUNNING && expected_idx == i,
+                  "tid %d (state %d, priority %d, event %d) sits in queue %d, expected %d",
+                  T->tid, T->state, T->c_priority, T->event_id, i, expected_idx);
+            CHECK(!T->cold->blocked_on, "queued tid %d also points at a sync queue", T->tid);
+            found++;
+        }
+        CHECK(Q->tail[i] == last, "tail of queue %d is not its last thread", i);
+    }
+
+    for (W = Q->wait_queues; W != NULL; W = W->next)
+    {
+        for (T = W->head; T != NULL; T = T->next)
+        {
+            visit(T, "sync queue");
+            CHECK(T->state == WAITING && T->cold->blocked_on == W,
+                  "tid %d on a sync queue has state %d", T->tid, T->state);
+            CHECK(W->order != WAIT_PRIORITY || !T->next || T->c_priority <= T->next->c_priority,
+                  "priority sync queue out of order at tid %d", T->tid);
+            found++;
+        }
+    }
+
+    for (int i = 0; i < Q->n_free; ++i)
+    {
+        T = &Q->threads[Q->free_slots[i]];
+        CHECK(T->state == UNUSED && ++seen[T - Q->threads] == 1, "free slot stack is corrupt at slot %d",
+              Q->free_slots[i]);
+        n_free++;
+    }
+
+    CHECK(found == live, "%ld threads alive but %ld reachable, a thread was lost", live, found);
+    CHECK(found + n_free == Q->n_slots, "%ld reachable + %ld free != %d slots", found, n_free, Q->n_slots);
+}
+
+/* cancel everything that is left and make sure the reclaimer gets it all */
+static void drain(void)
+{
+    Thread *T;
+
+    for (T = Q->threads; T < Q->threads + Q->n_slots; ++T)
+    {
+        if (T->state != UNUSED && T->state != TERMINATED)
+            cancel_thread(T);
+    }
+    while (run_op(OP_RECLAIM))
+        ;
+    check_invariants();
+    CHECK(live == 0, "%ld terminated threads were never reclaimed", live);
+}
+
+static Op pick_op(void)
+{
+    int r = rng_below(total_weight), k;
+
+    for (k = 0; r >= op_weights[k]; ++k)
+        r -= op_weights[k];
+    return k;
+}
+
+/* a fresh queue and generator, so a second pass runs the same steps */
+static void reset(void)
+{
+    if (Q)
+        free_queue(Q);
+    Q = create_queue();
+    Running = NULL;
+    rng_state = seed ? seed : 1;
+    tid_counter = 0;
+    live = 0;
+    for (int i = 0; i < N_SYNC_Q; ++i)
+        register_wait_queue(Q, &sync_q[i], i % 2 ? WAIT_PRIORITY : WAIT_FIFO);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-s seed] [-n steps] [-t threads] [-c interval] [-p]\n"
+                    "  -s seed      random seed, default 1\n"
+                    "  -n steps     operations to run, default %d\n"
+                    "  -t threads   population to keep alive, default %d\n"
+                    "  -c interval  check invariants every interval steps, default 1\n"
+                    "  -p           time every operation and print ns/op per type\n",
+            prog, DEFAULT_STEPS, DEFAULT_THREADS);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    long steps = DEFAULT_STEPS;
+    long interval = 1;
+    long applied = 0, t0, dt = 0, start, checked, elapsed;
+    bool ok;
+    Op op;
+
+    while ((opt = getopt(argc, argv, "s:n:t:c:p")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            steps = atol(optarg);
+            break;
+        case 't':
+            target_threads = atoi(optarg);
+            break;
+        case 'c':
+            interval = atol(optarg);
+            break;
+        case 'p':
+            time_ops = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (target_threads < 1 || target_threads > MAX_THREAD_NUM || interval < 1)
+        usage(argv[0]);
+
+    seen = malloc(MAX_THREAD_NUM);
+    for (int i = 0; i < N_OPS; ++i)
+        total_weight += op_weights[i];
+
+    reset();
+    start = now_nsec();
+    for (step = 0; step < steps; ++step)
+    {
+        op = pick_op();
+        if (time_ops)
+        {
+            t0 = now_nsec();
+            ok = run_op(op);
+            dt = now_nsec() - t0;
+        }
+        else
+        {
+            ok = run_op(op);
+        }
+        if (ok)
+        {
+            op_count[op]++;
+            op_nsec[op] += dt;
+            applied++;
+        }
+
+        if (step % interval == 0)
+            check_invariants();
+    }
+    checked = now_nsec() - start;
+    drain();
+
+    // the same steps again with no checks or clock reads, for the throughput
+    reset();
+    start = now_nsec();
+    for (step = 0; step < steps; ++step)
+        run_op(pick_op());
+    elapsed = now_nsec() - start;
+
+    printf("seed %lu, %ld steps, %ld operations applied, peak slots %d\n",
+           seed, steps, applied, Q->n_slots);
+    printf("%-14s%12s%s\n", "operation", "count", time_ops ? "       ns/op" : "");
+    for (int i = 0; i < N_OPS; ++i)
+    {
+        printf("%-14s%12ld", op_names[i], op_count[i]);
+        if (time_ops)
+            printf("%12.1f", op_count[i] ? (double)op_nsec[i] / op_count[i] : 0.0);
+        printf("\n");
+    }
+    printf("queue operations: %.0f ops/s\n", applied / ((double)elapsed / NSEC_PER_SEC));
+    printf("with invariant checks: %.0f ops/s\n", applied / ((double)checked / NSEC_PER_SEC));
+    printf("all invariants held\n");
+    return 0;
+}
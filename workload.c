@@ -0,0 +1,418 @@
+#include <time.h>
+#include "os2021_thread_api.h"
+#include "workload.h"
+
+#define MAX_TEMPLATES 64
+#define WAIT_TIME_UNIT_MSEC 10 // OS2021_ThreadWaitTime counts in timer ticks
+#define USEC_PER_SEC 1000000L
+
+#define FAIL_IF(EXP, ...)                     \
+    {                                         \
+        if (EXP)                              \
+        {                                     \
+            fprintf(stderr, __VA_ARGS__);     \
+            fprintf(stderr, "\n");            \
+            exit(EXIT_FAILURE);               \
+        }                                     \
+    }
+
+typedef enum
+{
+    PHASE_COMPUTE,
+    PHASE_SLEEP,
+    PHASE_WAIT_EVENT,
+    PHASE_SET_EVENT,
+    PHASE_SPAWN,
+    PHASE_LOOP,
+    PHASE_EXIT
+} PhaseOp;
+
+struct template_t;
+
+typedef struct
+{
+    PhaseOp op;
+    int arg;
+    int to;                   // loop target
+    struct template_t *child; // spawn template
+} Phase;
+
+typedef struct
+{
+    char name[MAX_STR_LEN];
+    long threads;
+    long spawn_failures;
+    long passes;
+    long cpu_msec;
+    long *latency_usec; // one sample per pass
+    long n_samples;
+    long cap_samples;
+} Class;
+
+typedef struct template_t
+{
+    char name[MAX_STR_LEN];
+    char priority[2];
+    int cancel_mode;
+    Class *class;
+    Phase *phases;
+    int n_phases;
+    int spawned; // suffix for the next thread created from it
+} Template;
+
+/* per-thread interpreter state, hung off ThreadCold.script */
+typedef struct
+{
+    Template *tpl;
+    int pc;
+    bool in_pass;
+    long pass_start_usec;
+    int cpu_mark;
+    int loops[]; // iterations left, per phase
+} ScriptRun;
+
+static Template templates[MAX_TEMPLATES];
+static Class classes[MAX_TEMPLATES];
+static int n_templates = 0;
+static int n_classes = 0;
+static int duration_msec = 0;
+
+static long now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static Template *find_template(const char *name)
+{
+    for (int i = 0; i < n_templates; ++i)
+    {
+        if (strncmp(templates[i].name, name, MAX_STR_LEN) == 0)
+            return &templates[i];
+    }
+    return NULL;
+}
+
+static Class *find_class(const char *name)
+{
+    for (int i = 0; i < n_classes; ++i)
+    {
+        if (strncmp(classes[i].name, name, MAX_STR_LEN) == 0)
+            return &classes[i];
+    }
+    strncpy(classes[n_classes].name, name, MAX_STR_LEN - 1);
+    return &classes[n_classes++];
+}
+
+static const char *get_string(struct json_object *obj, const char *key, const char *fallback)
+{
+    struct json_object *value;
+
+    if (json_object_object_get_ex(obj, key, &value))
+        return json_object_get_string(value);
+    return fallback;
+}
+
+static void parse_phase(Template *tpl, Phase *ph, struct json_object *phase, int index)
+{
+    struct json_object *value;
+
+    ph->to = 0;
+    ph->child = NULL;
+
+    if (json_object_object_get_ex(phase, "compute", &value))
+        ph->op = PHASE_COMPUTE;
+    else if (json_object_object_get_ex(phase, "sleep", &value))
+        ph->op = PHASE_SLEEP;
+    else if (json_object_object_get_ex(phase, "wait event", &value))
+        ph->op = PHASE_WAIT_EVENT;
+    else if (json_object_object_get_ex(phase, "set event", &value))
+        ph->op = PHASE_SET_EVENT;
+    else if (json_object_object_get_ex(phase, "spawn", &value))
+        ph->op = PHASE_SPAWN;
+    else if (json_object_object_get_ex(phase, "loop", &value))
+        ph->op = PHASE_LOOP;
+    else if (json_object_object_get_ex(phase, "exit", &value))
+        ph->op = PHASE_EXIT;
+    else
+        FAIL_IF(true, "Template %s: phase %d has no known operation.", tpl->name, index);
+
+    ph->arg = json_object_get_int(value);
+    FAIL_IF(ph->arg < 0, "Template %s: phase %d has a negative argument.", tpl->name, index);
+    FAIL_IF((ph->op == PHASE_WAIT_EVENT || ph->op == PHASE_SET_EVENT) && ph->arg >= N_EVENT_Q,
+            "Template %s: phase %d uses event %d, events are 0-%d.", tpl->name, index, ph->arg,
+            N_EVENT_Q - 1);
+
+    if (ph->op == PHASE_LOOP && json_object_object_get_ex(phase, "to", &value))
+    {
+        ph->to = json_object_get_int(value);
+        FAIL_IF(ph->to < 0 || ph->to > index,
+                "Template %s: phase %d loops forward or out of range.", tpl->name, index);
+    }
+}
+
+/* spawn phases name their template, which may be defined further down */
+static void resolve_children(struct json_object *tpl_array)
+{
+    struct json_object *script, *phase;
+    const char *child;
+
+    for (int i = 0; i < n_templates; ++i)
+    {
+        json_object_object_get_ex(json_object_array_get_idx(tpl_array, i), "script", &script);
+        for (int j = 0; j < templates[i].n_phases; ++j)
+        {
+            if (templates[i].phases[j].op != PHASE_SPAWN)
+                continue;
+            phase = json_object_array_get_idx(script, j);
+            child = get_string(phase, "template", NULL);
+            FAIL_IF(!child, "Template %s: spawn phase %d names no template.", templates[i].name, j);
+            templates[i].phases[j].child = find_template(child);
+            FAIL_IF(!templates[i].phases[j].child, "Template %s: unknown template %s.",
+                    templates[i].name, child);
+        }
+    }
+}
+
+void workload_load(struct json_object *config)
+{
+    struct json_object *tpl_array, *tpl_obj, *script, *value;
+    Template *tpl;
+    size_t n;
+
+    if (json_object_object_get_ex(config, "Duration", &value))
+        duration_msec = json_object_get_int(value);
+
+    if (!json_object_object_get_ex(config, "Templates", &tpl_array))
+        return;
+
+    n = json_object_array_length(tpl_array);
+    FAIL_IF(n > MAX_TEMPLATES, "At most %d templates are supported.", MAX_TEMPLATES);
+
+    for (int i = 0; i < n; ++i)
+    {
+        tpl_obj = json_object_array_get_idx(tpl_array, i);
+        tpl = &templates[n_templates++];
+
+        strncpy(tpl->name, get_string(tpl_obj, "name", ""), MAX_STR_LEN - 1);
+        FAIL_IF(!*tpl->name, "Template %d has no name.", i);
+        tpl->class = find_class(get_string(tpl_obj, "class", tpl->name));
+        tpl->priority[0] = *get_string(tpl_obj, "priority", "M");
+        priority_stoi(tpl->priority);
+        tpl->cancel_mode = atoi(get_string(tpl_obj, "cancel mode", "1"));
+
+        FAIL_IF(!json_object_object_get_ex(tpl_obj, "script", &script),
+                "Template %s has no script.", tpl->name);
+        tpl->n_phases = json_object_array_length(script);
+        tpl->phases = calloc(tpl->n_phases, sizeof(Phase));
+        for (int j = 0; j < tpl->n_phases; ++j)
+            parse_phase(tpl, &tpl->phases[j], json_object_array_get_idx(script, j), j);
+    }
+    resolve_children(tpl_array);
+}
+
+int workload_duration(void)
+{
+    return duration_msec;
+}
+
+/* caller is inside API_ENTER */
+static Thread *create_script_thread(Template *tpl, const char *name, const char *priority)
+{
+    Thread *T;
+    ScriptRun *run;
+
+    T = create_thread((char *)name, "Script", (char *)priority, tpl->cancel_mode);
+    if (!T)
+    {
+        tpl->class->spawn_failures++;
+        return NULL;
+    }
+
+    run = malloc(sizeof(ScriptRun) + tpl->n_phases * sizeof(int));
+    run->tpl = tpl;
+    run->pc = 0;
+    run->in_pass = false;
+    run->cpu_mark = 0;
+    for (int i = 0; i < tpl->n_phases; ++i)
+        run->loops[i] = tpl->phases[i].arg;
+    T->cold->script = run;
+    tpl->class->threads++;
+    return T;
+}
+
+int workload_create_threads(const char *template_name, const char *name, const char *priority, int count)
+{
+    Template *tpl = find_template(template_name);
+    char thread_name[MAX_STR_LEN];
+    int created = 0;
+
+    FAIL_IF(!tpl, "Unknown template %s.", template_name);
+
+    API_ENTER();
+    for (int i = 0; i < count; ++i)
+    {
+        if (count == 1)
+            strncpy(thread_name, name, MAX_STR_LEN - 1);
+        else
+            snprintf(thread_name, MAX_STR_LEN, "%.100s-%d", name, i);
+        thread_name[MAX_STR_LEN - 1] = '\0';
+        if (create_script_thread(tpl, thread_name, priority ? priority : tpl->priority))
+            created++;
+    }
+    API_EXIT();
+
+    return created;
+}
+
+static void spawn_children(Template *tpl, int count)
+{
+    char thread_name[MAX_STR_LEN];
+
+    API_ENTER();
+    for (int i = 0; i < count; ++i)
+    {
+        snprintf(thread_name, MAX_STR_LEN, "%.100s-%d", tpl->name, tpl->spawned++);
+        create_script_thread(tpl, thread_name, tpl->priority);
+    }
+    API_EXIT();
+}
+
+static void end_pass(ScriptRun *run)
+{
+    Class *class = run->tpl->class;
+    long now = now_usec();
+
+    if (!run->in_pass)
+        return;
+    run->in_pass = false;
+
+    API_ENTER();
+    if (class->n_samples == class->cap_samples)
+    {
+        class->cap_samples = class->cap_samples ? class->cap_samples * 2 : 1024;
+        class->latency_usec = realloc(class->latency_usec, class->cap_samples * sizeof(long));
+    }
+    class->latency_usec[class->n_samples++] = now - run->pass_start_usec;
+    class->passes++;
+    API_EXIT();
+}
+
+static void account_cpu(ScriptRun *run)
+{
+    int cpu_time = Running->cold->cpu_time;
+
+    run->tpl->class->cpu_msec += cpu_time - run->cpu_mark;
+    run->cpu_mark = cpu_time;
+}
+
+/* the generic engine: interprets Running's script until it exits */
+void Script(void)
+{
+    ScriptRun *run = Running->cold->script;
+    Phase *ph;
+    int until;
+
+    while (run && run->pc < run->tpl->n_phases)
+    {
+        if (!run->in_pass)
+        {
+            run->in_pass = true;
+            run->pass_start_usec = now_usec();
+        }
+
+        ph = &run->tpl->phases[run->pc++];
+        switch (ph->op)
+        {
+        case PHASE_COMPUTE:
+            until = Running->cold->cpu_time + ph->arg;
+            while (Running->cold->cpu_time < until)
+                OS2021_TestCancel();
+            break;
+        case PHASE_SLEEP:
+            OS2021_ThreadWaitTime((ph->arg + WAIT_TIME_UNIT_MSEC - 1) / WAIT_TIME_UNIT_MSEC);
+            break;
+        case PHASE_WAIT_EVENT:
+            OS2021_ThreadWaitEvent(ph->arg);
+            break;
+        case PHASE_SET_EVENT:
+            OS2021_ThreadSetEvent(ph->arg);
+            break;
+        case PHASE_SPAWN:
+            spawn_children(ph->child, ph->arg);
+            break;
+        case PHASE_LOOP:
+            end_pass(run);
+            if (ph->arg == 0 || --run->loops[run->pc - 1] > 0)
+                run->pc = ph->to;
+            else
+                run->loops[run->pc - 1] = ph->arg;
+            break;
+        case PHASE_EXIT:
+            run->pc = run->tpl->n_phases;
+            break;
+        }
+        account_cpu(run);
+    }
+
+    if (run)
+        end_pass(run);
+    OS2021_ThreadExit();
+}
+
+static int compare_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/* nearest-rank percentile in ms, samples must be sorted */
+static double percentile_msec(Class *class, int p)
+{
+    long rank;
+
+    if (class->n_samples == 0)
+        return 0.0;
+    rank = (class->n_samples * p + 99) / 100;
+    if (rank < 1)
+        rank = 1;
+    return class->latency_usec[rank - 1] / 1000.0;
+}
+
+void workload_report(long elapsed_msec)
+{
+    long passes = 0, cpu_msec = 0;
+    double seconds = elapsed_msec / 1000.0;
+    Class *class;
+
+    if (n_classes == 0)
+        return;
+
+    printf("\n---------------------------------------------------------------------------------------\n");
+    printf("Workload summary after %ld ms\n", elapsed_msec);
+    printf("%-14s%-9s%-9s%-10s%-10s%-10s%-10s%-10s%-8s\n",
+           "Class", "Threads", "Passes", "Passes/s", "P50(ms)", "P90(ms)", "P99(ms)", "Max(ms)", "CPU%");
+
+    for (int i = 0; i < n_classes; ++i)
+    {
+        class = &classes[i];
+        qsort(class->latency_usec, class->n_samples, sizeof(long), compare_long);
+        printf("%-14s%-9ld%-9ld%-10.1f%-10.1f%-10.1f%-10.1f%-10.1f%-8.1f\n",
+               class->name, class->threads, class->passes,
+               seconds > 0 ? class->passes / seconds : 0.0,
+               percentile_msec(class, 50), percentile_msec(class, 90), percentile_msec(class, 99),
+               percentile_msec(class, 100),
+               elapsed_msec > 0 ? 100.0 * class->cpu_msec / elapsed_msec : 0.0);
+        if (class->spawn_failures)
+            printf("  %ld threads of class %s could not be created\n", class->spawn_failures, class->name);
+        passes += class->passes;
+        cpu_msec += class->cpu_msec;
+    }
+
+    printf("Total: %ld passes, %.1f passes/s, scripts used %.1f%% of the CPU\n", passes,
+           seconds > 0 ? passes / seconds : 0.0,
+           elapsed_msec > 0 ? 100.0 * cpu_msec / elapsed_msec : 0.0);
+    printf("---------------------------------------------------------------------------------------\n");
+    fflush(stdout);
+}
@@ -0,0 +1,26 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <json-c/json.h>
+
+/* Declarative workloads: a "Templates" array in the thread config
+ * describes threads as scripts of phases, run by the Script entry.
+ *
+ *   {"compute": ms}                 burn ms of CPU time
+ *   {"sleep": ms}                   OS2021_ThreadWaitTime
+ *   {"wait event": id}              OS2021_ThreadWaitEvent
+ *   {"set event": id}               OS2021_ThreadSetEvent
+ *   {"spawn": n, "template": name}  create n threads from another template
+ *   {"loop": n, "to": phase}        run phases from "to" (default 0) n times, 0 = forever
+ *   {"exit": 1}                     terminate the thread
+ *
+ * A pass ends at every loop phase and at exit; its wall time is the
+ * latency reported per template class. */
+
+void workload_load(struct json_object *config);
+int workload_create_threads(const char *template_name, const char *name, const char *priority, int count);
+int workload_duration(void);
+void workload_report(long elapsed_msec);
+void Script(void);
+
+#endif